@@ -1,10 +1,17 @@
 ﻿using System;
 using System.Diagnostics;
+using System.Linq;
 
 namespace Run {
     class Run {
         static void Main(params string[] args) {
-            var program = new Program(args.Length > 0 ? args[0] : "next/program");
+            var path = args.FirstOrDefault(a => a.StartsWith("--") == false) ?? "next/program";
+            var program = new Program(path) {
+                ProfileAllocations = args.Contains("--profile-alloc"),
+                SafeMode = args.Contains("--safe"),
+                BuildProfile = args.Contains("--pgo") ? BuildProfile.Pgo : args.Contains("--release") ? BuildProfile.Release : BuildProfile.Debug,
+                Training = args.FirstOrDefault(a => a.StartsWith("--train="))?["--train=".Length..],
+            };
             program.Parse();
             program.Build(true);
             program.Validate();
@@ -1,5 +1,6 @@
 ﻿using Microsoft.VisualStudio.TestTools.UnitTesting;
 using System;
+using System.Diagnostics;
 using System.IO;
 using System.Text;
 
@@ -89,13 +90,619 @@ namespace Run {
               """);
         }
 
-        public void TestCode(string code) {
-            var program = new Program(new MemoryStream(Encoding.UTF8.GetBytes(code)));
+        [TestMethod]
+        public void TestIs() {
+            TestCode("""
+              type Animal {
+              }
+              type Dog : Animal {
+              }
+              main {
+                var d = new Dog()
+                var n = 5
+                if d is Animal {
+                }
+                if n is i32 {
+                }
+              }
+              """);
+        }
+
+        [TestMethod]
+        public void TestIsAny() {
+            TestCode("""
+              type Animal {
+              }
+              type Dog : Animal {
+              }
+              main {
+                var a = new Dog() as any
+                var n = 7 as any
+                if a is Animal {
+                }
+                if n is Dog {
+                }
+              }
+              """);
+        }
+
+        [TestMethod]
+        public void TestScope() {
+            TestCode("""
+              type Node {
+              }
+              main {
+                for var i=0;i<10;i++ {
+                  scope {
+                    var n = new Node()
+                    defer {
+                      print("done")
+                    }
+                    if i == 5 {
+                      return
+                    }
+                  }
+                }
+              }
+              """);
+        }
+
+        [TestMethod]
+        public void TestEscape() {
+            TestCode("""
+              type Node {
+                var value:int
+                var next:Node
+                this(v:int) {
+                  value = v
+                }
+              }
+              func make(v:int) : Node {
+                var n = new Node(v)
+                return n
+              }
+              main {
+                var local = new Node(1)
+                var kept = make(2)
+                kept.next = new Node(local.value)
+              }
+              """);
+        }
+
+        [TestMethod]
+        public void TestProfileAlloc() {
+            TestCode("""
+              type Item {
+                var v:int
+                this(x:int) {
+                  v = x
+                }
+              }
+              func keep(x:int) : Item {
+                return new Item(x)
+              }
+              main {
+                var it = keep(1)
+                delete it
+                var buf = new int[100]
+              }
+              """, true);
+        }
+
+        [TestMethod]
+        public void TestAlign() {
+            TestCode("""
+              @align(64)
+              type Counter {
+                var hits:int
+              }
+              main {
+                var c = new Counter()
+                var all = new Counter[4]
+              }
+              """);
+        }
+
+        [TestMethod]
+        public void TestMap() {
+            TestCode("""
+              using map
+              type Point {
+                var x:i32
+              }
+              main {
+                var m = new map<string, any>()
+                var key = new string("one")
+                m.set(key, 1 as any)
+                if m.contains(key) && (m.get(key) as i32) == 1 {
+                  m.remove(key)
+                }
+                var mask = (m.size ^ 5) & 3 | 8
+                print("%d\n", mask)
+                var ints = new map<i32, i32>()
+                for var i..100 => ints.set(i * 7, i)
+                ints.remove(14)
+                var total = 0
+                for var i = ints.next(0); i >= 0; i = ints.next(i + 1) => total = total + ints.valueAt(i)
+                print("%d\n", total)
+                print("%d\n", ints.get(21) + ints.get(14) + ints.size)
+                var points = new map<string, Point>()
+                var p = new Point()
+                p.x = 5
+                points.set(new string("five"), p)
+                print("%d\n", points.get(new string("five")).x)
+                points.remove(new string("five"))
+                if points.get(new string("five")) == null => print("%d\n", points.size)
+              }
+              """, output: "9\n4948\n102\n5\n0\n");
+        }
+
+        [TestMethod]
+        public void TestGenericArray() {
+            TestCode("""
+              type Point {
+                var x:i32
+              }
+              function sum(values:array<i32>):i32 {
+                var total = 0
+                for var i..values.size => total = total + values[i]
+                return total
+              }
+              main {
+                var ints = new array<i32>()
+                ints.add(1)
+                ints.add(2)
+                var points = new array<Point>(4)
+                points.add(new Point())
+                var found = ints.indexOf(2) + sum(ints) + points.get(0).x
+              }
+              """);
+        }
+
+        [TestMethod]
+        public void TestNestedArray() {
+            TestCode("""
+              type Box {
+                var items:i32[]
+                this {
+                  items = new i32[4]
+                }
+                function dispose() {
+                  delete items
+                }
+              }
+              main {
+                var rows = new array<array<i32>>(1)
+                for var r..3 {
+                  var row = new array<i32>(1)
+                  for var c..5 => row.add(r * 10 + c)
+                  rows.add(row)
+                }
+                var total = rows[2][4] + rows.get(1).size
+                rows.dispose()
+                var b = new Box()
+                delete b
+              }
+              """, compile: true);
+        }
+
+        [TestMethod]
+        public void TestInterfaceDispatch() {
+            TestCode("""
+              interface Shape {
+                function area():i32 { }
+              }
+              type Square : Shape {
+                var side:i32
+                this(.side) {}
+                function area():i32 => side * side
+              }
+              type Rect : Shape {
+                var w:i32
+                var h:i32
+                this(.w, .h) {}
+                function area():i32 => w * h
+              }
+              type Animal {
+                function legs():i32 => 4
+              }
+              type Bird : Animal {
+                function legs():i32 => 2
+              }
+              type Dog : Animal {
+              }
+              function total(a:Shape, b:Shape):i32 => a.area() + b.area()
+              function count(a:Animal):i32 => a.legs()
+              main {
+                var s = new Square(3)
+                print("%d\n", total(s, new Rect(2, 5)) + s.area())
+                print("%d\n", count(new Bird()) + count(new Dog()) * 10 + count(new Animal()) * 100)
+              }
+              """, output: "28\n442\n");
+        }
+
+        [TestMethod]
+        public void TestSafeNullChecks() {
+            var c = TestCode("""
+              type Node {
+                var value:i32
+                var next:Node
+                this(.value) {}
+              }
+              function sum(head:Node):i32 {
+                var total = 0
+                for var n = head; n != null; n = n.next => total = total + n.value
+                return total
+              }
+              main {
+                var a = new Node(1)
+                a.next = new Node(2)
+                var s = sum(a)
+                for var i..10 => s = s + a.value + a.next.value
+                var b = a.next
+                if b != null => s = s + b.value
+                delete a
+                s = s + a.value
+              }
+              """, safe: true);
+            // tested against null, no check
+            Assert.IsTrue(c.Contains("_s=_s+_b->_value;"));
+            // deleted, so null again and checked
+            var deleted = c.IndexOf("DELETE(_a)");
+            Assert.IsTrue(deleted > 0 && c.IndexOf("CHECK_Node(_a", deleted) > deleted);
+        }
+
+        [TestMethod]
+        public void TestSafeGoto() {
+            TestCode("""
+              type Node {
+                var value:i32
+                this(.value) {}
+              }
+              main {
+                var a = new Node(1)
+                var n = 0
+                label top
+                n = n + a.value
+                if n > 1 => return
+                a = null
+                goto top
+              }
+              """, safe: true);
+        }
+
+        [TestMethod]
+        public void TestInlineAccessors() {
+            var c = TestCode("""
+              type Point {
+                var x:i32
+                var items:i32[]
+                @inline
+                property sum:i32 => x * 2
+                indexer [i:i32]:i32 {
+                  get => items[i]
+                  set => items[i] = value
+                }
+                function getX():i32 => x
+                function setX(value:i32) {
+                  this.x = value
+                }
+              }
+              main {
+                var p = new Point()
+                p.items = new i32[4]
+                p.setX(3)
+                p[1] = p.getX()
+                var total = p[1] + p.sum
+                print("%d\n", total)
+                print("%d\n", p.items[1])
+              }
+              """, output: "9\n3\n");
+            // the accessors are gone from the call sites
+            Assert.IsTrue(c.Contains("(_p)->_x = 3;"));
+            Assert.IsTrue(c.Contains("(_p)->_items[1] = (_p)->_x;"));
+        }
+
+        [TestMethod]
+        public void TestStringConcat() {
+            var c = TestCode("""
+              main {
+                var name = new string("bob")
+                var n = 42
+                var s = name + ", you are " + n.toString() + " and " + "folded" + name
+                print("%s\n", s.value)
+                print("%d\n", s.size)
+              }
+              """, output: "bob, you are 42 and foldedbob\n29\n");
+            // one sized concatenation, the literals next to each other joined by C
+            Assert.IsTrue(c.Contains("_string *_s = StringConcat(__current_region__, 5,"));
+            Assert.IsTrue(c.Contains("\" and \" \"folded\""));
+        }
+
+        [TestMethod]
+        public void TestStringKernels() {
+            TestCode("""
+              main {
+                var s = new string("the quick brown fox, the end")
+                var the = new string("the")
+                var found = s.indexOf(the, 1) + s.lastIndexOf(the) + s.size
+                var same = s.equals(new string("the quick brown fox, the end"))
+                var hash = s.hashCode
+              }
+              """);
+        }
+
+        [TestMethod]
+        public void TestInternedLiterals() {
+            TestCode("""
+              main {
+                var a:string = "interned"
+                var b = "interned"
+                var same = a == b
+                var escaped = "tab\there\n"
+                var hash = escaped.hashCode + a.size
+                if (a as pointer) == (b as pointer) => print("%s\n", "same")
+                if same => print("%d\n", escaped.size)
+              }
+              """, output: "same\n9\n");
+        }
+
+        [TestMethod]
+        public void TestCallWithoutArguments() {
+            TestCode("""
+              function ping() { }
+              static type Log {
+                static function flush() { }
+              }
+              main {
+                ping()
+                Log.flush()
+              }
+              """);
+        }
+
+        [TestMethod]
+        public void TestBufferedWriters() {
+            // stdout is a pipe here, nothing goes out before the exit flush
+            TestCode("""
+              using io
+              main {
+                Console.write(new string("sum "))
+                Console.writeLine(40 + 2)
+                var w = File.create(new string("buffered.txt"))
+                w.writeLine(new string("kept"))
+                w.write(7)
+                w.close()
+                var r = File.open(new string("buffered.txt"))
+                var s = r.readAll()
+                r.dispose()
+                Console.write(s.substring(0, 5))
+                Console.writeLine(s.size)
+                if File.delete(new string("buffered.txt")) => Console.writeLine(new string("deleted"))
+                if File.exists(new string("buffered.txt")) == false => Console.writeLine(new string("gone"))
+              }
+              """, output: "sum 42\nkept\n9\ndeleted\ngone\n");
+        }
+
+        [TestMethod]
+        public void TestMappedReader() {
+            TestCode("""
+              using io
+              main {
+                var w = new FileWriter(new string("mapped.bin"), FileWriterMode.WRITE_BINARY)
+                w.write(1234)
+                w.write(new string("mapped"))
+                w.close()
+                var r = File.openMapped(new string("mapped.bin"))
+                Console.writeLine(r.readAll().size)
+                Console.writeLine(r.readI32())
+                Console.writeLine(r.readString(6))
+                if r.readString(1) == null => Console.writeLine(r.ended)
+                if r.readAll() == null => Console.writeLine(new string("ended"))
+                r.dispose()
+                File.delete(new string("mapped.bin"))
+              }
+              """, output: "10\n1234\nmapped\n2\nended\n");
+        }
+
+        [TestMethod]
+        public void TestEventLoop() {
+            // the listener takes a null ip, it listens on every interface
+            TestCode("""
+              using net
+              main {
+                var loop = new EventLoop()
+                var anywhere:string = null
+                var server = new Listener(anywhere, 0)
+                server.listen()
+                loop.add(server)
+                var client = new Socket(new string("127.0.0.1"), server.port)
+                client.connect()
+                loop.add(client)
+                client.write(new string("ping"))
+                var echoed = 0
+                for var round..50 {
+                  if echoed == 4 => break
+                  var n = loop.wait(100)
+                  for var i..n {
+                    var s = loop.socket(i)
+                    if s.listening {
+                      var c = server.accept()
+                      if c != null => loop.add(c)
+                    } else if s.readable {
+                      if s == client {
+                        var got = s.read()
+                        echoed = echoed + got.size
+                        if got.equals(new string("ping")) => print("%s\n", "ping")
+                      } else {
+                        s.write(s.read())
+                      }
+                    }
+                  }
+                }
+                print("%d\n", echoed)
+                loop.dispose()
+              }
+              """, output: "ping\n4\n");
+        }
+
+        [TestMethod]
+        public void TestParallelFor() {
+            TestCode("""
+              using thread
+              type Worker: Thread {
+                var sum:i64
+                function run {
+                  for var i..100 => sum += i
+                }
+              }
+              main {
+                var n = 1000
+                var values = new i64[n]
+                parallel for var i..n {
+                  values[i] = i
+                }
+                var total = new Reduction()
+                parallel for var i = 10..n {
+                  total.add(values[i])
+                }
+                var w = new Worker()
+                w.start()
+                w.join()
+              }
+              """);
+        }
+
+        [TestMethod]
+        public void TestParallelBounds() {
+            var c = TestCode("""
+              main {
+                var n:i64 = 1000
+                var values = new i64[n]
+                parallel for var i..n {
+                  values[i] = i
+                }
+              }
+              """);
+            Assert.AreEqual(null, c);
+        }
+
+        [TestMethod]
+        public void TestThreadReduction() {
+            TestCode("""
+              using thread
+              type Adder: Thread {
+                var total:Reduction
+                this(.total) {}
+                function run {
+                  for var i..1000 {
+                    total.add(1)
+                    total.addReal(0.5)
+                  }
+                }
+              }
+              main {
+                var total = new Reduction()
+                var a = new Adder(total)
+                var b = new Adder(total)
+                a.start()
+                b.start()
+                for var i..1000 => total.add(1)
+                a.join()
+                b.join()
+                var sum = total.total
+              }
+              """, compile: true);
+        }
+
+        [TestMethod]
+        public void TestAtomics() {
+            TestCode("""
+              using atomic
+              type Stats {
+                @atomic var hits:i64
+                @atomic var last:pointer
+              }
+              main {
+                var s = new Stats()
+                s.hits++
+                atomicAdd(ref s.hits, 2, memoryRelaxed())
+                var seen = atomicLoad(ref s.hits, memoryAcquire())
+                var counter = new AtomicI32()
+                counter.store(3, memoryRelease())
+                counter.compareExchange(3, 4)
+                var p = new AtomicPointer()
+                p.compareExchange(null, s as pointer)
+                atomicFence(memorySeqCst())
+                print("%lld\n", seen)
+                print("%d\n", counter.load(memoryAcquire()))
+                if p.load(memoryAcquire()) == (s as pointer) => print("%s\n", "set")
+              }
+              """, output: "3\n4\nset\n");
+        }
+
+        [TestMethod]
+        public void TestReflectionLookup() {
+            TestCode("""
+              type Point {
+                var x:i32
+                var y:i32
+                this(.x, .y) {}
+                function sum():i32 => x + y
+                function sum(k:i32):i32 => x + y + k
+                static function origin():i32 => 0
+              }
+              type Empty {
+              }
+              @native(exit($code))
+              function quit(code:i32)
+              main {
+                var p = new Point(1, 2)
+                var t = getType(new string("Point"))
+                if t == null => quit(1)
+                if getType(new string("Missing")) != null => quit(2)
+                if getType(new string("Empty")) == null => quit(3)
+                if t.getMember(new string("x")) == null => quit(4)
+                if t.getMember(new string("missing")) != null => quit(5)
+                if t.getMember(new string("su")) != null => quit(6)
+                if t.getFunction(new string("sum")) == null => quit(7)
+                if t.getFunction(new string("x")) != null => quit(8)
+                if t.getFunction(new string("missing")) != null => quit(9)
+                print("%d\n", p.sum() + p.sum(3))
+              }
+              """, output: "9\n");
+        }
+
+        // returns the generated C
+        public string TestCode(string code, bool profile = false, bool safe = false, bool compile = false, string output = null) {
+            var program = new Program(new MemoryStream(Encoding.UTF8.GetBytes(code))) {
+                ProfileAllocations = profile,
+                SafeMode = safe,
+            };
             program.Parse();
             program.Build();
             program.Validate();
+            // nothing is transpiled when the code has errors, the C of the
+            // test before must not pass for this one
+            var c = Path.Combine(program.ExecutionFolder, program.Path + ".c");
+            File.Delete(c);
             program.Transpile();
+            // goes on through the C compiler, so the generated code is checked too
+            if (compile || output != null) {
+                program.Compile();
+                Assert.AreEqual(0, program.Errors.Count);
+            }
+            // and runs it, it has to exit with 0 and print output
+            if (output != null) {
+                var binary = Path.Combine(program.ExecutionFolder, program.Token.Value + (OperatingSystem.IsWindows() ? ".exe" : ""));
+                using var process = Process.Start(new ProcessStartInfo(binary) { RedirectStandardOutput = true });
+                var printed = process.StandardOutput.ReadToEnd();
+                process.WaitForExit();
+                Assert.AreEqual(0, process.ExitCode);
+                Assert.AreEqual(output, printed);
+            }
             Assert.IsTrue(true);
+            return File.Exists(c) ? File.ReadAllText(c) : null;
         }
     }
 }
@@ -0,0 +1,310 @@
+// allocator benchmark, built once per allocator, see Makefile
+//   BENCH_ARENA  lib/arena.h regions
+//   BENCH_PAGES  lib/allocator.h memory pages
+//   otherwise    libc malloc
+// every scenario runs in its own process, so peak RSS is per scenario;
+// committed is what the allocator holds from the system, read every
+// BENCH_SAMPLE allocations and frees
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(BENCH_ARENA)
+#include "../lib/arena.h"
+#define BENCH_NAME "arena"
+static void BenchInit() { ArenaInit(ARENA_CAPACITY); }
+static void BenchClose() { ArenaClose(); }
+static void* BenchAlloc(int size, int type) { return ArenaAlloc(size, NULL, type); }
+static void BenchFree(void* ptr) { ArenaFree(ptr); }
+static bool BenchIS(void* ptr, int type) { return ArenaIS(ptr, type); }
+static long BenchCommitted() { return arena ? arena->committed : 0; }
+#define BENCH_SAMPLE 1
+#elif defined(BENCH_PAGES)
+#include "../lib/allocator.h"
+#define BENCH_NAME "pages"
+static void BenchInit() { SetupAlloc(); }
+static void BenchClose() {}
+static void* BenchAlloc(int size, int type) { return AllocType(size, type); }
+static void BenchFree(void* ptr) { Free(ptr); }
+static bool BenchIS(void* ptr, int type) {
+    int found = 0;
+    return GetPointer((char*)ptr, NULL, &found) > 0 && found == type;
+}
+static long BenchCommitted() { return GetMemoryStats().Committed; }
+#define BENCH_SAMPLE 1
+#else
+#define BENCH_NAME "malloc"
+// the same type tag the other allocators keep in their headers
+static void BenchInit() {}
+static void BenchClose() {}
+static void* BenchAlloc(int size, int type) {
+    int64_t* ptr = (int64_t*)malloc(size + sizeof(int64_t) * 2);
+    if (ptr == NULL) return NULL;
+    ptr[0] = type;
+    return ptr + 2;
+}
+static void BenchFree(void* ptr) {
+    if (ptr) free((int64_t*)ptr - 2);
+}
+static bool BenchIS(void* ptr, int type) { return ptr && ((int64_t*)ptr - 2)[0] == type; }
+// heap and mmap'd bytes glibc holds; it walks the bins, so it is read
+// rarely enough to stay out of the timings
+static long BenchCommitted() {
+    struct mallinfo2 info = mallinfo2();
+    return (long)(info.arena + info.hblkhd);
+}
+#define BENCH_SAMPLE 4096
+#endif
+
+typedef struct Result {
+    long ops;
+    double seconds;
+    long peakLive;
+    long peakCommitted;
+} Result;
+
+static uint64_t seed = 88172645463325252ull;
+static long live = 0;
+static long peakLive = 0;
+static long peakCommitted = 0;
+static long samples = 0;
+
+static void Sample() {
+    if (++samples % BENCH_SAMPLE) return;
+    long committed = BenchCommitted();
+    if (committed > peakCommitted) peakCommitted = committed;
+}
+
+static uint64_t Next() {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static double Now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// mostly small objects, some strings and arrays, a few big buffers
+static int MixedSize() {
+    int r = Next() % 100;
+    if (r < 70) return 16 + Next() % 112;
+    if (r < 95) return 128 + Next() % 896;
+    if (r < 99) return 1024 + Next() % 7168;
+    return 8192 + Next() % 57344;
+}
+
+static void* Take(int size, int type) {
+    void* ptr = BenchAlloc(size, type);
+    if (ptr == NULL) {
+        fprintf(stderr, "allocation of %d bytes failed\n", size);
+        exit(1);
+    }
+    memset(ptr, 1, size < 64 ? size : 64);
+    live += size;
+    if (live > peakLive) peakLive = live;
+    Sample();
+    return ptr;
+}
+
+static void Release(void* ptr, int size) {
+    BenchFree(ptr);
+    live -= size;
+    Sample();
+}
+
+static void Shuffle(int* order, int count) {
+    for (int i = 0; i < count; i++) order[i] = i;
+    for (int i = count - 1; i > 0; i--) {
+        int j = Next() % (i + 1);
+        int temp = order[i];
+        order[i] = order[j];
+        order[j] = temp;
+    }
+}
+
+// allocate and free the same small size back to back
+static long Churn(long scale) {
+    long ops = 0;
+    for (long i = 0; i < scale * 100; i++) {
+        void* ptr = Take(48, 1);
+        Release(ptr, 48);
+        ops += 2;
+    }
+    return ops;
+}
+
+// a working set of live objects where a random one is replaced every step
+static long Mixed(long scale) {
+    int count = 4096;
+    void** slots = (void**)calloc(count, sizeof(void*));
+    int* sizes = (int*)calloc(count, sizeof(int));
+    long ops = 0;
+    for (long i = 0; i < scale * 20; i++) {
+        int index = Next() % count;
+        if (slots[index]) {
+            Release(slots[index], sizes[index]);
+            ops++;
+        }
+        sizes[index] = MixedSize();
+        slots[index] = Take(sizes[index], 2);
+        ops++;
+    }
+    for (int i = 0; i < count; i++) {
+        if (slots[i]) Release(slots[i], sizes[i]);
+    }
+    free(slots);
+    free(sizes);
+    return ops + count;
+}
+
+static long Batch(long scale, bool lifo) {
+    int count = 10000;
+    void** slots = (void**)malloc(count * sizeof(void*));
+    int* sizes = (int*)malloc(count * sizeof(int));
+    int* order = (int*)malloc(count * sizeof(int));
+    long ops = 0;
+    for (long round = 0; round < scale / 500 + 1; round++) {
+        for (int i = 0; i < count; i++) {
+            sizes[i] = MixedSize();
+            slots[i] = Take(sizes[i], 3);
+        }
+        if (lifo) {
+            for (int i = count - 1; i >= 0; i--) Release(slots[i], sizes[i]);
+        } else {
+            Shuffle(order, count);
+            for (int i = 0; i < count; i++) Release(slots[order[i]], sizes[order[i]]);
+        }
+        ops += count * 2;
+    }
+    free(slots);
+    free(sizes);
+    free(order);
+    return ops;
+}
+
+static long Lifo(long scale) { return Batch(scale, true); }
+static long RandomOrder(long scale) { return Batch(scale, false); }
+
+// keeps every other small object alive, then asks for bigger blocks
+// that can only fit in the holes once they are merged
+static long Fragmentation(long scale) {
+    int count = 50000;
+    void** slots = (void**)malloc(count * sizeof(void*));
+    long ops = 0;
+    for (int i = 0; i < count; i++) {
+        slots[i] = Take(64, 4);
+    }
+    for (int i = 0; i < count; i += 2) {
+        Release(slots[i], 64);
+        slots[i] = NULL;
+    }
+    ops += count + count / 2;
+    int bigger = count / 8;
+    void** big = (void**)malloc(bigger * sizeof(void*));
+    for (long round = 0; round < scale / 2000 + 1; round++) {
+        for (int i = 0; i < bigger; i++) big[i] = Take(200, 5);
+        for (int i = 0; i < bigger; i++) Release(big[i], 200);
+        ops += bigger * 2;
+    }
+    for (int i = 1; i < count; i += 2) {
+        Release(slots[i], 64);
+    }
+    free(slots);
+    free(big);
+    return ops + count / 2;
+}
+
+// is checks on live objects of a few types
+static long Lookups(long scale) {
+    int count = 4096;
+    void** slots = (void**)malloc(count * sizeof(void*));
+    for (int i = 0; i < count; i++) slots[i] = Take(32 + i % 64, i % 7);
+    long ops = 0, found = 0;
+    for (long i = 0; i < scale * 100; i++) {
+        int index = Next() % count;
+        found += BenchIS(slots[index], index % 7);
+        ops++;
+    }
+    if (found != ops) fprintf(stderr, "%ld of %ld lookups failed\n", ops - found, ops);
+    for (int i = 0; i < count; i++) Release(slots[i], 32 + i % 64);
+    free(slots);
+    return ops;
+}
+
+typedef struct Scenario {
+    const char* name;
+    long (*run)(long scale);
+} Scenario;
+
+static Scenario scenarios[] = {
+    {"churn", Churn},
+    {"mixed", Mixed},
+    {"lifo", Lifo},
+    {"random", RandomOrder},
+    {"fragmentation", Fragmentation},
+    {"is", Lookups},
+};
+
+static void Run(Scenario* scenario, long scale, int pipe) {
+    BenchInit();
+    double start = Now();
+    Result result = {0};
+    result.ops = scenario->run(scale);
+    result.seconds = Now() - start;
+    result.peakLive = peakLive;
+    result.peakCommitted = peakCommitted;
+    BenchClose();
+    if (write(pipe, &result, sizeof(result)) != sizeof(result)) exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    long scale = argc > 1 ? atol(argv[1]) : 10000;
+    const char* only = argc > 2 ? argv[2] : NULL;
+    printf("%-8s %-14s %10s %12s %12s %12s %8s\n", "alloc", "scenario", "ns/op", "peak rss kb", "committed kb", "peak live kb",
+           "frag");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        Scenario* scenario = &scenarios[i];
+        if (only && strcmp(only, scenario->name) != 0) continue;
+        int fds[2];
+        if (pipe(fds) != 0) return 1;
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            Run(scenario, scale, fds[1]);
+            exit(0);
+        }
+        close(fds[1]);
+        Result result = {0};
+        int status = 0;
+        struct rusage usage;
+        ssize_t got = read(fds[0], &result, sizeof(result));
+        close(fds[0]);
+        wait4(pid, &status, 0, &usage);
+        if (got != sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("%-8s %-14s %10s\n", BENCH_NAME, scenario->name, "failed");
+            continue;
+        }
+        double ns = result.seconds * 1e9 / (result.ops ? result.ops : 1);
+        double peakLive = result.peakLive / 1024.0;
+        double committed = result.peakCommitted / 1024.0;
+        // held from the system per live byte, headers and free space included
+        double frag = peakLive > 0 ? committed / peakLive : 0;
+        printf("%-8s %-14s %10.1f %12ld %12.0f %12.0f %8.2f\n", BENCH_NAME, scenario->name, ns, usage.ru_maxrss,
+               committed, peakLive, frag);
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+// allocator checks, see Makefile: make test
+// every check prints what it measured and the program fails if one did not hold
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/arena.h"
+
+static int failures = 0;
+
+#define CHECK(condition, ...)          \
+    do {                               \
+        if (!(condition)) {            \
+            printf("FAIL %s: ", __func__); \
+            printf(__VA_ARGS__);       \
+            putchar('\n');             \
+            failures++;                \
+        }                              \
+    } while (0)
+
+static uint64_t seed = 88172645463325252ull;
+
+static uint64_t Next() {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+// mostly small objects, some strings and arrays, a few big buffers
+static int MixedSize() {
+    int r = Next() % 100;
+    if (r < 70) return 16 + Next() % 112;
+    if (r < 95) return 128 + Next() % 896;
+    if (r < 99) return 1024 + Next() % 7168;
+    return 8192 + Next() % 57344;
+}
+
+// the chunks the root region grew, scopes are not used here
+static int Chunks() { return arena->region->children_size; }
+
+// a bounded live set replaced at random must not keep adding chunks, and
+// freeing it all must give the chunks back
+static void ChurnStaysBounded() {
+    ArenaInit(ARENA_CAPACITY);
+    int count = 20000;
+    void** slots = (void**)calloc(count, sizeof(void*));
+    long steps = 2000000;
+    int warm = 0, most = 0;
+    for (long i = 0; i < steps; i++) {
+        int index = Next() % count;
+        if (slots[index]) ArenaFree(slots[index]);
+        slots[index] = ArenaAlloc(MixedSize(), NULL, 1);
+        if (i == steps / 4) warm = Chunks();
+        if (i > steps / 4 && Chunks() > most) most = Chunks();
+    }
+    long live = arena->size;
+    CHECK(most * 4 <= warm * 5, "%d chunks after warm up, up to %d later", warm, most);
+    CHECK((long)Chunks() * ARENA_CAPACITY <= live * 2, "%d chunks for %ld live bytes", Chunks(), live);
+    for (int i = 0; i < count; i++) ArenaFree(slots[i]);
+    CHECK(Chunks() <= 1, "%d chunks left with nothing live", Chunks());
+    CHECK(arena->size == 0, "%d bytes still counted live", arena->size);
+    CHECK(arena->committed <= 3 * (long)(sizeof(Region) + ARENA_CAPACITY), "%ld bytes committed with nothing live",
+          arena->committed);
+    printf("churn: %d chunks after warm up, at most %d, %d at the end\n", warm, most, Chunks());
+    free(slots);
+    ArenaClose();
+}
+
+// a few live objects left in every chunk must not keep the chunks resident
+static void SparseChunksAreReleased() {
+    ArenaInit(ARENA_CAPACITY);
+    int count = 40000;
+    void** slots = (void**)calloc(count, sizeof(void*));
+    for (int i = 0; i < count; i++) slots[i] = ArenaAlloc(40, NULL, 1);
+    for (int i = 0; i < count; i++) {
+        if (i % 2000) ArenaFree(slots[i]);
+    }
+    // around each live object: its page and the first and last page of
+    // the free blocks next to it, plus the tail and what was freed since
+    // the trim before last
+    long bound = (long)Chunks() * (4 * ARENA_PAGE + sizeof(Region)) + ARENA_CAPACITY + 2 * ARENA_SLACK;
+    CHECK(arena->committed <= bound, "%ld bytes committed for %d live bytes in %d chunks", arena->committed,
+          arena->size, Chunks());
+    printf("sparse: %ld bytes committed for %d live bytes in %d chunks\n", arena->committed, arena->size, Chunks());
+    for (int i = 0; i < count; i += 2000) ArenaFree(slots[i]);
+    free(slots);
+    ArenaClose();
+}
+
+#define HANDED 1000
+
+static void* handed[HANDED];
+
+// keeps half of what it allocates alive for the main thread, frees the rest
+static void* HandOver(void* argument) {
+    void* own[HANDED];
+    for (int i = 0; i < HANDED; i++) {
+        handed[i] = ArenaAlloc(16 + Next() % 1024, NULL, 2);
+        own[i] = ArenaAlloc(16 + Next() % 1024, NULL, 2);
+    }
+    for (int i = 0; i < HANDED; i++) ArenaFree(own[i]);
+    return argument;
+}
+
+static void* FreeAll(void* argument) {
+    for (int i = 0; i < HANDED; i++) ArenaFree(ArenaAlloc(64, NULL, 2));
+    return argument;
+}
+
+static int Orphans() {
+    int count = 0;
+    for (Arena* orphan = ArenaOrphans; orphan; orphan = orphan->next) count++;
+    return count;
+}
+
+// an ended thread hands its arena to the next one while blocks of it are
+// live, and closes it when there are none
+static void ThreadArenasAreReused() {
+    ArenaInit(ARENA_CAPACITY);
+    Arena* first = NULL;
+    int most = 0;
+    for (int round = 0; round < 50; round++) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, HandOver, NULL);
+        pthread_join(thread, NULL);
+        Arena* owner = ArenaOwner(handed[0]);
+        if (first == NULL) first = owner;
+        CHECK(owner == first, "round %d allocated from a new arena", round);
+        for (int i = 0; i < HANDED; i++) ArenaFree(handed[i]);
+        if (Orphans() > most) most = Orphans();
+    }
+    CHECK(most <= 1, "up to %d orphaned arenas", most);
+    pthread_t thread;
+    pthread_create(&thread, NULL, FreeAll, NULL);
+    pthread_join(thread, NULL);
+    CHECK(Orphans() == 0, "%d orphaned arenas after a thread freed all it had", Orphans());
+    printf("threads: at most %d orphaned arena, %d at the end\n", most, Orphans());
+    ArenaClose();
+}
+
+int main() {
+    ChurnStaysBounded();
+    SparseChunksAreReleased();
+    ThreadArenasAreReused();
+    if (failures) printf("%d checks failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -5,6 +5,9 @@
 #include <memory.h>
 #include <stdio.h>
 #include <stdlib.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 int negate(int i) { return i > 0 ? -i : i; }
 
@@ -15,6 +18,9 @@ static int Init = 0;
 static short MagicNumber = 12345;
 
 static long ScopeID = 0;
+// pieces of freed blocks smaller than this stay committed
+const int OS_PAGE = 4096;
+#define HEADER_SIZE ((int)(sizeof(int) * 2 + sizeof(short) + sizeof(MemoryPage*)))
 
 #define class typedef struct
 
@@ -28,11 +34,27 @@ class MemoryPage {
 	MemoryPage* Next;
 	MemoryPage* Previous;
 	int Scope;
+	// bytes of freed blocks already given back to the os
+	int Released;
 	void (*Reset)(MemoryPage*);
 	MemoryPage* (*Add)(MemoryPage*);
 	void (*Destroy)(MemoryPage*);
 } MemoryPage;
 
+// committed: page bytes handed out and not given back to the os
+// used: live blocks, headers included
+// free listed: freed blocks still inside their pages
+// limit: committed bytes allowed, 0 for no limit
+class MemoryStats {
+	long Committed;
+	long Used;
+	long FreeListed;
+	long Limit;
+	int Pages;
+} MemoryStats;
+
+static MemoryStats AllocatorStats = { 0 };
+
 // class Pointer {
 //   char* Ptr;
 //   MemoryPage* MemoryPage;
@@ -43,7 +65,7 @@ void* Alloc(int);
 void* AllocType(int, int);
 void SetupAlloc();
 int Free(void* ptr);
-int GetPointer(char*, MemoryPage*, int*);
+int GetPointer(char*, MemoryPage**, int*);
 MemoryPage* PageNew(int capacity);
 char* NextSpace(MemoryPage* page, char* ptr);
 char* FindSpace(MemoryPage* page, int size);
@@ -56,13 +78,68 @@ class PageAllocation {
 
 MemoryPage* CurrentPage = 0, * HeadPage = 0, * CurrentScope = 0;
 
+char* PageMap(int capacity) {
+#ifdef _WIN32
+	return (char*)malloc(capacity);
+#else
+	void* data = mmap(0, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return data == MAP_FAILED ? 0 : (char*)data;
+#endif
+}
+
+void PageUnmap(char* data, int capacity) {
+#ifdef _WIN32
+	free(data);
+#else
+	munmap(data, capacity);
+#endif
+}
+
+// gives the whole os pages inside [start, end) back, returns how many bytes
+int PageDecommit(char* start, char* end) {
+#ifdef _WIN32
+	return 0;
+#else
+	char* from = (char*)(((size_t)start + OS_PAGE - 1) & ~(size_t)(OS_PAGE - 1));
+	char* to = (char*)((size_t)end & ~(size_t)(OS_PAGE - 1));
+	if (to <= from) return 0;
+	madvise(from, to - from, MADV_DONTNEED);
+	return (int)(to - from);
+#endif
+}
+
+// forgets every block of an empty page, the memory itself goes back to the os
+void PageClear(MemoryPage* page) {
+	AllocatorStats.Committed -= page->Offset - page->Released;
+	AllocatorStats.FreeListed -= page->Offset - page->Size;
+	AllocatorStats.Used -= page->Size;
+	PageDecommit(page->Pointer, page->Pointer + page->Offset);
+	page->Size = 0;
+	page->Offset = 0;
+	page->Items = 0;
+	page->Released = 0;
+}
+
+void PageRelease(MemoryPage* page) {
+	if (page->Pointer) {
+		AllocatorStats.Committed -= page->Offset - page->Released;
+		AllocatorStats.FreeListed -= page->Offset - page->Size;
+		AllocatorStats.Used -= page->Size;
+		AllocatorStats.Pages--;
+		PageUnmap(page->Pointer, page->Capacity);
+	}
+	page->Pointer = 0;
+	page->Size = 0;
+	page->Offset = 0;
+	page->Items = 0;
+	page->Released = 0;
+}
+
 MemoryPage* PageAdd(MemoryPage*);
 void PageReset(MemoryPage* s) {
 	MemoryPage* current = s;
 	while (current) {
-		current->Size = 0;
-		current->Offset = 0;
-		current->Items = 0;
+		PageClear(current);
 		current = current->Next;
 	}
 }
@@ -74,13 +151,10 @@ void PageDestroy(MemoryPage* s) {
 		s->Previous->Next = 0;
 	}
 	while (current) {
-		current->Size = 0;
-		current->Offset = 0;
-		free(current->Pointer);
-		current->Pointer = 0;
+		PageRelease(current);
 		current = current->Next;
 		if (current) {
-			Free((char*)current->Previous);
+			free(current->Previous);
 			current->Previous = 0;
 		}
 	}
@@ -108,8 +182,7 @@ MemoryPage* PageAdd(MemoryPage* s) {
 }
 
 int Valid(void* ptr) {
-	long l = (long)ptr;
-	return l > 0 && l < ULONG_MAX;
+	return ptr != 0;
 }
 
 void PageCheck(MemoryPage* page) {
@@ -149,8 +222,11 @@ void PageInitialize(MemoryPage* p, int capacity) {
 	// p->MinFree = 0;
 	p->Offset = 0u;
 	p->Previous = 0;
+	p->Released = 0;
 	p->Capacity = capacity > BIG ? capacity : BIG;
-	p->Pointer = (char*)malloc(p->Capacity);
+	p->Pointer = PageMap(p->Capacity);
+	if (!p->Pointer) abort();
+	AllocatorStats.Pages++;
 }
 
 MemoryPage* PageNew(int capacity) {
@@ -169,8 +245,8 @@ char* NextSpace(MemoryPage* page, char* ptr) {
 	}
 	while (ptr < page->Pointer + page->Offset) {
 		int size = 0, type = 0;
-		MemoryPage page;
-		if (!(size = GetPointer(ptr, &page, &type))) {
+		MemoryPage* owner = 0;
+		if (!(size = GetPointer(ptr, &owner, &type))) {
 			return ptr;
 		}
 		if (size > 0) {
@@ -188,9 +264,9 @@ inline char* FindSpace(MemoryPage* page, int size) {
 	int sz = 0;
 	int count = 0;
 	while (ptr < page->Pointer + page->Offset) {
-		MemoryPage page;
+		MemoryPage* owner = 0;
 		int type = 0;
-		int sz = GetPointer(ptr, &page, &type);
+		int sz = GetPointer(ptr, &owner, &type);
 		if (sz < 0) {
 			sz *= -1;
 			if (sz >= size && sz <= size * 1.5) {
@@ -216,6 +292,9 @@ inline char* FindSpace(MemoryPage* page, int size) {
 
 MemoryPage* FreePage(MemoryPage* current) {
 	MemoryPage* temp = 0;
+	if (current == HeadPage) {
+		HeadPage = current->Next;
+	}
 	if (current->Next) {
 		temp = current->Next;
 		if (current->Previous) {
@@ -227,7 +306,7 @@ MemoryPage* FreePage(MemoryPage* current) {
 		temp = current->Previous;
 		current->Previous->Next = 0;
 	}
-	free(current->Pointer);
+	PageRelease(current);
 	free(current);
 	if (temp) {
 		current = temp;
@@ -239,58 +318,69 @@ MemoryPage* FreePage(MemoryPage* current) {
 	return current;
 }
 
-int GetPointer(char* ptr, MemoryPage* page, int* type) {
+// returns the size stamp of the block, negative once it was freed,
+// and the page that owns it
+int GetPointer(char* ptr, MemoryPage** page, int* type) {
 	if (!Valid(ptr)) {
 		return 0;
 	}
 	ptr -= sizeof(short);
-	if (!*ptr) {
-		return 0;
-	}
 	short mn = *((short*)ptr);
 	if (mn != MagicNumber) {
 		return 0;
 	}
 	ptr -= sizeof(int);
-	if (!*ptr) {
-		return 0;
-	}
 	int size = *((int*)ptr);
-	if (size <= 0) {
-		return 0;
-	}
 	ptr -= sizeof(MemoryPage*);
-	if (!*ptr) {
+	MemoryPage* owner = *((MemoryPage**)ptr);
+	if (!owner) {
 		return 0;
 	}
-	*page = **((MemoryPage**)ptr);
-
 	ptr -= sizeof(int);
-	if (!*ptr) {
-		return 0;
-	}
-	*type = *((int*)ptr);
+	if (page) *page = owner;
+	if (type) *type = *((int*)ptr);
 	return size;
 }
 
 int Free(void* p) {
 	char* ptr = (char*)p;
 	int size = 0, type = 0;
-	MemoryPage page;
-	if (!(size = GetPointer(ptr, &page, &type))) {
+	MemoryPage* page = 0;
+	if ((size = GetPointer(ptr, &page, &type)) <= 0) {
 		return 0;
 	}
-	if (size < 0) {
-		return 0;
+	*((int*)(ptr - sizeof(short) - sizeof(int))) = negate(size);
+	int real = size + HEADER_SIZE;
+	page->Size -= real;
+	page->Items--;
+	AllocatorStats.Used -= real;
+	AllocatorStats.FreeListed += real;
+	if (page->Items == 0) {
+		// the page in use keeps its mapping, any other one is unmapped
+		if (page == CurrentPage || page == CurrentScope) {
+			PageClear(page);
+		}
+		else {
+			FreePage(page);
+		}
+		return size;
 	}
-	ptr -= sizeof(int);
-	*((int*)ptr) = negate(size);
-	page.Size -= size;
-	page.Items--;
-	CurrentPage = page.Size > 0 ? &page : FreePage(&page);
+	// whole os pages inside a big freed block go back right away
+	int released = PageDecommit(ptr, ptr + size);
+	page->Released += released;
+	AllocatorStats.Committed -= released;
 	return size;
 }
 
+MemoryStats GetMemoryStats() {
+	return AllocatorStats;
+}
+
+// allocations that would commit more than bytes fail, 0 removes the limit
+void SetMemoryLimit(long bytes) {
+	AllocatorStats.Limit = bytes;
+}
+
 void* AssignPointer(char* dest, char* src) {
 	//   Pointer* p1 = GetPointer(dest);
 	//   Pointer* p2 = GetPointer(src);
@@ -335,7 +425,7 @@ MemoryPage* PageResize(MemoryPage* page, int size) {
 
 char* SetPointer(MemoryPage* page, int size, int type) {
 	char* ptr = page->Pointer + page->Offset;
-	*ptr = type;
+	*((int*)ptr) = type;
 	ptr += sizeof(int);
 	*((MemoryPage**)ptr) = page;
 	ptr += sizeof(MemoryPage*);
@@ -347,7 +437,10 @@ char* SetPointer(MemoryPage* page, int size, int type) {
 }
 
 char* PageAlloc(MemoryPage* page, int size, int type) {
-	int real = size + (sizeof(int) * 2) + sizeof(short) + sizeof(MemoryPage*);
+	int real = size + HEADER_SIZE;
+	if (AllocatorStats.Limit > 0 && AllocatorStats.Committed + real > AllocatorStats.Limit) {
+		return 0;
+	}
 	MemoryPage* alloc = PageResize(page, real);
 	//   if (alloc->Pointer) {
 	//     if (CurrentScope) {
@@ -362,6 +455,8 @@ char* PageAlloc(MemoryPage* page, int size, int type) {
 	page->Size += real;
 	page->Offset += real;
 	page->Items++;
+	AllocatorStats.Committed += real;
+	AllocatorStats.Used += real;
 	if (CurrentScope) {
 		CurrentScope = page;
 	}
@@ -385,14 +480,16 @@ void* Realloc(void* ptr, int newsize) {
 	if (!Valid(ptr)) {
 		return 0;
 	}
-	MemoryPage page;
 	int type = 0;
-	int oldSize = GetPointer((char*)ptr, &page, &type);
-	void* newPtr = Alloc(newsize);
+	int oldSize = GetPointer((char*)ptr, 0, &type);
+	if (oldSize <= 0) {
+		return 0;
+	}
+	void* newPtr = AllocType(newsize, type);
 	if (!newPtr) {
 		abort();
 	}
-	memcpy(newPtr, ptr, oldSize);
+	memcpy(newPtr, ptr, oldSize < newsize ? oldSize : newsize);
 	Free((char*)ptr);
 	return newPtr;
 }
\ No newline at end of file
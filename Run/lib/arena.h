@@ -1,18 +1,108 @@
+#include <limits.h>
 #include <memory.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 
 typedef struct Arena Arena;
 typedef struct Region Region;
+typedef struct FreeBlock FreeBlock;
+typedef struct HugeBlock HugeBlock;
+
+// every thread allocates from its own arena; tcc has no thread support,
+// so there the arena is a plain global and the atomics are plain accesses
+#if defined(__GNUC__) && !defined(__TINYC__)
+#define ARENA_THREAD __thread
+#define ARENA_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define ARENA_EXCHANGE(ptr, value) __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL)
+#define ARENA_CAS(ptr, expected, value) \
+    __atomic_compare_exchange_n(ptr, expected, value, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+#else
+#define ARENA_THREAD
+#define ARENA_LOAD(ptr) (*(ptr))
+#define ARENA_EXCHANGE(ptr, value) ArenaExchange((void**)(ptr), value)
+#define ARENA_CAS(ptr, expected, value) (*(ptr) = (value), true)
+#endif
+// with pthreads an arena outlives its thread while blocks of it are live
+#if defined(__GNUC__) && !defined(__TINYC__) && !defined(_WIN32)
+#include <pthread.h>
+#define ARENA_ORPHANS
+#endif
 
 static short NormalZone = 12342;
 static short FreeZone = 12340;
-static short ScopeZone = 12343;
+// also the magic of blocks the compiler lays out statically, where it
+// has to be a constant
+#define ARENA_SCOPE_ZONE 12343
+static short ScopeZone = ARENA_SCOPE_ZONE;
 static short RegionZone = 12341;
-static uint16_t RegionID = 0;
-const int SizeOfPointer = 18;
+static short HugeZone = 12344;
+// header in front of an over-aligned block, pointing back to the real one
+static short AlignedZone = 12345;
+static ARENA_THREAD uint16_t RegionID = 0;
+
+// every block starts with this header; at 16 bytes it keeps payloads
+// on the 16 byte alignment of the region data, which malloc gives us
+typedef struct BlockHeader {
+    Region* region;
+    int size;
+    uint16_t typeID;
+    short magic;
+} BlockHeader;
+
+#define ARENA_ALIGN 16
+const int SizeOfPointer = (int)sizeof(BlockHeader);
+
+// size classes: 32..512 in steps of 16, then powers of two up to 1GB
+#define ARENA_BINS 64
+#define ARENA_SMALL_STEP 16
+#define ARENA_SMALL_MAX 512
+#define ARENA_SMALL_BINS (ARENA_SMALL_MAX / ARENA_SMALL_STEP - 1)
+#define ARENA_MAX_CLASS (1 << 30)
+// set in the size field of a block whose physical predecessor is free
+#define ARENA_PREV_FREE 0x40000000
+// capacity of the arena a thread gets on its first allocation
+#define ARENA_CAPACITY (64 * 1024)
+// blocks from this size on get their own mapping instead of region space
+#define ARENA_HUGE (256 * 1024)
+// the whole pages inside free blocks from this size on can go back to the
+// system; that happens once the free space kept resident grows by more
+// than the slack, or by half the live bytes when that is more
+#define ARENA_DECOMMIT (16 * 1024)
+#define ARENA_SLACK (256 * 1024)
+#define ARENA_PAGE 4096
+
+#define BLOCK_HEADER(ptr) ((BlockHeader*)((char*)(ptr) - SizeOfPointer))
+#define BLOCK_SIZE(ptr) (BLOCK_HEADER(ptr)->size)
+#define BLOCK_MAGIC(ptr) (BLOCK_HEADER(ptr)->magic)
+#define BLOCK_REGION(ptr) (BLOCK_HEADER(ptr)->region)
+#define BLOCK_TYPE(ptr) (BLOCK_HEADER(ptr)->typeID)
+#define BLOCK_FOOTER(ptr, size) (*((int*)((char*)(ptr) + (size) - sizeof(int))))
+
+// a freed block reuses its payload as links of the bin list and keeps
+// its size in the last bytes, so the following block can find it;
+// released counts the bytes of its pages given back to the system and
+// epoch is the trim it was freed after
+typedef struct FreeBlock {
+    FreeBlock* next;
+    FreeBlock* prev;
+    int released;
+    int epoch;
+} FreeBlock;
+
+// a huge block lives alone in its mapping, after this link and its header;
+// the header keeps the owner region, which frees it when closed
+typedef struct HugeBlock {
+    HugeBlock* next;
+    HugeBlock* prev;
+    size_t length;
+} HugeBlock;
+
+#define HUGE_OFFSET ((int)((sizeof(HugeBlock) + SizeOfPointer + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1)))
 
 typedef struct Region {
     short magic;
@@ -22,24 +112,46 @@ typedef struct Region {
     int capacity;
     int children_size;
     int children_capacity;
+    int index;
+    // bytes of its free blocks given back to the system
+    int released;
     char* data;
     Region** children;
     Region* parent;
+    Arena* arena;
+    Region* owner;
+    Region* tail;
+    uint64_t binmap;
+    FreeBlock* bins[ARENA_BINS];
+    HugeBlock* huge;
 } Region;
 
 typedef struct Arena {
     int size;
     int capacity;
     Region* region;
+    // blocks freed by other threads, pushed lock-free and
+    // given back to the regions by the owning thread
+    FreeBlock* remote;
+    // link of the orphan list
+    Arena* next;
+    // bytes taken from the system: regions, their data and huge mappings
+    long committed;
+    // committed bytes not live after the last trim
+    long retained;
+    // trims done so far
+    int epoch;
 } Arena;
 
 void* Allocate(int size) { return malloc(size); }
 void Free(void* ptr) { free(ptr); }
 
-static Arena* arena = NULL;
+static ARENA_THREAD Arena* arena = NULL;
 Region* RegionNew(int capacity);
 bool GetDefinition(void* ptr, int* typeID, int* size, Region* region);
 void SetDefinition(void* ptr, int typeID, int size, Region* region);
+Region* GetRegion(char* ptr, int* size);
+void HugeClose(Region* owner);
 
 int Align(int size, int alignment) {
     int diff = size % alignment;
@@ -47,6 +159,72 @@ int Align(int size, int alignment) {
     return size;
 }
 
+int SizeClass(int size) {
+    if (size <= ARENA_SMALL_STEP * 2) return 0;
+    if (size <= ARENA_SMALL_MAX) return (size + ARENA_SMALL_STEP - 1) / ARENA_SMALL_STEP - 2;
+    int index = ARENA_SMALL_BINS;
+    int capacity = ARENA_SMALL_MAX * 2;
+    while (capacity < size && capacity < ARENA_MAX_CLASS) {
+        capacity <<= 1;
+        index++;
+    }
+    return index;
+}
+
+int ClassSize(int index) {
+    if (index < ARENA_SMALL_BINS) return (index + 2) * ARENA_SMALL_STEP;
+    return (ARENA_SMALL_MAX * 2) << (index - ARENA_SMALL_BINS);
+}
+
+int BinIndex(int size) {
+    if (size < ARENA_SMALL_MAX) return size / ARENA_SMALL_STEP - 2;
+    int index = ARENA_SMALL_BINS - 1;
+    int capacity = ARENA_SMALL_MAX * 2;
+    while (capacity <= size && capacity < ARENA_MAX_CLASS) {
+        capacity <<= 1;
+        index++;
+    }
+    return index;
+}
+
+void BinPush(Region* owner, char* ptr, int size) {
+    int index = BinIndex(size);
+    FreeBlock* block = (FreeBlock*)ptr;
+    block->prev = NULL;
+    block->next = owner->bins[index];
+    if (block->next) block->next->prev = block;
+    owner->bins[index] = block;
+    owner->binmap |= (uint64_t)1 << index;
+    BLOCK_FOOTER(ptr, size) = size;
+}
+
+void BinRemove(Region* owner, char* ptr, int size) {
+    int index = BinIndex(size);
+    FreeBlock* block = (FreeBlock*)ptr;
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        owner->bins[index] = block->next;
+    }
+    if (block->next) block->next->prev = block->prev;
+    if (owner->bins[index] == NULL) owner->binmap &= ~((uint64_t)1 << index);
+}
+
+int BinFind(Region* owner, int index) {
+    if (index >= ARENA_BINS) return -1;
+    uint64_t map = owner->binmap >> index;
+    if (map == 0) return -1;
+#if defined(__GNUC__) && !defined(__TINYC__)
+    return index + __builtin_ctzll(map);
+#else
+    while ((map & 1) == 0) {
+        map >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
 bool RegionResize(Region* region) {
     if (region->children == NULL) {
         region->children_capacity = 4;
@@ -71,6 +249,9 @@ bool RegionResize(Region* region) {
 }
 
 Region* RegionAdd(Region* parent, int size) {
+    // regions of another thread are never touched, their children
+    // would race with that thread, so the new one goes to our root
+    if (parent->arena != arena) parent = arena->region;
     int capacity = arena->capacity;
     if (capacity < size) capacity = size;
     Region* region = RegionNew(capacity);
@@ -81,43 +262,145 @@ Region* RegionAdd(Region* parent, int size) {
         return NULL;
     }
     region->parent = parent;
+    region->index = parent->children_size;
     parent->children[parent->children_size] = region;
     parent->children_size++;
     return region;
 }
 
+// the pages of a free block past its links and before its size footer
+char* ReleaseFrom(char* ptr) {
+    return (char*)(((uintptr_t)ptr + sizeof(FreeBlock) + ARENA_PAGE - 1) & ~(uintptr_t)(ARENA_PAGE - 1));
+}
+
+char* ReleaseTo(char* ptr, int size) {
+    return (char*)((uintptr_t)(ptr + size - sizeof(int)) & ~(uintptr_t)(ARENA_PAGE - 1));
+}
+
+// decommits the pages of a free block, the space stays reserved but
+// not resident; pages released before are counted once
+void ArenaRelease(Region* chunk, char* ptr, int size) {
+#if !defined(_WIN32)
+    FreeBlock* block = (FreeBlock*)ptr;
+    char* from = ReleaseFrom(ptr);
+    char* to = ReleaseTo(ptr, size);
+    if (to - from - block->released < ARENA_DECOMMIT) return;
+    madvise(from, to - from, MADV_DONTNEED);
+    int released = (int)(to - from) - block->released;
+    block->released += released;
+    chunk->released += released;
+    arena->committed -= released;
+#endif
+}
+
+// releases the big free blocks of a region still mostly resident that
+// were already free at the previous trim, so space freed and taken again
+// soon is not faulted back in
+void ArenaTrim(Region* owner) {
+    for (int index = BinIndex(ARENA_DECOMMIT); index < ARENA_BINS; index++) {
+        for (FreeBlock* block = owner->bins[index]; block; block = block->next) {
+            if (block->epoch == arena->epoch) continue;
+            ArenaRelease(BLOCK_REGION(block), (char*)block, BLOCK_SIZE(block) & ~ARENA_PREV_FREE);
+        }
+    }
+    arena->retained = arena->committed - arena->size;
+    arena->epoch++;
+}
+
+// a free block being handed out counts as committed again, its pages
+// come back as they are touched
+int ArenaRecommit(Region* chunk, char* ptr) {
+    FreeBlock* block = (FreeBlock*)ptr;
+    int released = block->released;
+    chunk->released -= released;
+    arena->committed += released;
+    block->released = 0;
+    return released;
+}
+
+// puts the unused top of a chunk in the bins, once the chunk stops
+// being the tail nothing else would hand it out
+void RegionRetire(Region* owner, Region* chunk) {
+    int rest = chunk->capacity - chunk->offset - SizeOfPointer;
+    if (rest < ARENA_SMALL_STEP * 2) return;
+    char* ptr = chunk->data + chunk->offset + SizeOfPointer;
+    SetDefinition(ptr - SizeOfPointer, 0, rest, chunk);
+    BLOCK_MAGIC(ptr) = FreeZone;
+    chunk->offset = chunk->capacity;
+    BinPush(owner, ptr, rest);
+    ((FreeBlock*)ptr)->released = 0;
+    ((FreeBlock*)ptr)->epoch = arena->epoch;
+}
+
+void RegionClose(Region* region);
+
+// adds another chunk of memory to a region, sharing the region bins. An
+// empty tail is too small for the size and goes away, any other one is
+// retired
+Region* RegionGrow(Region* owner, int size) {
+    Region* tail = owner->tail;
+    if (tail != owner && tail->offset == 0) {
+        RegionClose(tail);
+    } else {
+        RegionRetire(owner, tail);
+    }
+    Region* chunk = RegionAdd(owner, size + SizeOfPointer);
+    if (chunk == NULL) return NULL;
+    chunk->owner = owner;
+    owner->tail = chunk;
+    return chunk;
+}
+
 Region* RegionNew(int capacity) {
-    capacity = Align(capacity, 4);
+    capacity = Align(capacity, ARENA_ALIGN);
     Region* region = (Region*)Allocate(sizeof(Region));
     if (region == NULL) {
         puts("Failed to allocate memory for region");
         exit(-1);
     }
+    memset(region, 0, sizeof(Region));
     region->magic = RegionZone;
     region->id = RegionID++;
-    region->size = 0;
-    region->offset = 0;
-    region->children_size = 0;
     region->children_capacity = 4;
     region->capacity = capacity;
-    region->children = NULL;
+    region->arena = arena;
+    region->owner = region;
+    region->tail = region;
     region->data = (char*)Allocate(capacity);
     if (region->data == NULL) {
         puts("Failed to allocate memory for region data");
         exit(-1);
     }
+    arena->committed += sizeof(Region) + capacity;
     return region;
 }
 
 void RegionReset(Region* region) {
     if (region->children) {
-        for (int i = 0; i < region->children_size; i++) {
-            RegionReset(region->children[i]);
+        for (int i = region->children_size - 1; i >= 0; i--) {
+            RegionClose(region->children[i]);
         }
     }
+    HugeClose(region);
+    arena->size -= region->size;
+    arena->committed += region->released;
+    region->released = 0;
     region->size = 0;
     region->offset = 0;
     region->children_size = 0;
+    region->tail = region;
+    region->binmap = 0;
+    memset(region->bins, 0, sizeof(region->bins));
+}
+
+void RegionDetach(Region* parent, Region* region) {
+    int index = region->index;
+    if (index < parent->children_size && parent->children[index] == region) {
+        parent->children_size--;
+        parent->children[index] = parent->children[parent->children_size];
+        parent->children[index]->index = index;
+    }
+    if (parent->tail == region) parent->tail = parent;
 }
 
 void RegionClose(Region* region) {
@@ -129,19 +412,21 @@ void RegionClose(Region* region) {
         }
         Free(region->children);
     }
-    if (region->parent) region->parent->children_size--;
+    if (region->parent) RegionDetach(region->parent, region);
+    HugeClose(region);
+    arena->size -= region->size;
     region->children_size = 0;
     region->offset = 0;
     region->size = 0;
-    region->capacity = 0;
     region->children = NULL;
     region->parent = NULL;
+    arena->committed -= sizeof(Region) + region->capacity - region->released;
     Free(region->data);
     Free(region);
 }
 
 void* AllocPointer(Region* region, int size, int typeID) {
-    void* ptr = region->data + region->offset;
+    char* ptr = region->data + region->offset;
     SetDefinition(ptr, typeID, size, region);
     region->size += size + SizeOfPointer;
     region->offset += size + SizeOfPointer;
@@ -149,138 +434,306 @@ void* AllocPointer(Region* region, int size, int typeID) {
     return (void*)(ptr + SizeOfPointer);
 }
 
-int RegionFind(Region* region, int* size) {
-    if (region->offset < SizeOfPointer) {
-        return -1;
-    }
-    char* data = region->data;
-    int index = 0, tempSize = 0, tempTypeID = 0;
-    Region tempRegion = { 0 };
-    while (index < region->offset) {
-        if (GetDefinition(data, &tempTypeID, &tempSize, &tempRegion) == false) {
-            return -1;
+// takes the first free block of the smallest bin that fits, splitting
+// whatever is left over back into the bins
+void* BinAlloc(Region* owner, int size, int typeID) {
+    int index = BinFind(owner, SizeClass(size));
+    while (index >= 0) {
+        char* ptr = (char*)owner->bins[index];
+        int found = BLOCK_SIZE(ptr) & ~ARENA_PREV_FREE;
+        if (found < size) {
+            index = BinFind(owner, index + 1);
+            continue;
         }
-        if (tempSize >= *size) {
-            *size = tempSize;
-            return index;
+        BinRemove(owner, ptr, found);
+        Region* chunk = BLOCK_REGION(ptr);
+        int epoch = ((FreeBlock*)ptr)->epoch;
+        int released = ArenaRecommit(chunk, ptr);
+        char* end = chunk->data + chunk->offset;
+        int rest = found - size - SizeOfPointer;
+        if (rest >= ARENA_SMALL_STEP * 2) {
+            char* split = ptr + size + SizeOfPointer;
+            SetDefinition(split - SizeOfPointer, 0, rest, chunk);
+            BLOCK_MAGIC(split) = FreeZone;
+            BinPush(owner, split, rest);
+            // the rest ends where the block did, so when the whole block
+            // was released its pages were too
+            ((FreeBlock*)split)->released = 0;
+            ((FreeBlock*)split)->epoch = epoch;
+            if (released && released == ReleaseTo(ptr, found) - ReleaseFrom(ptr) && ReleaseTo(split, rest) > ReleaseFrom(split)) {
+                ((FreeBlock*)split)->released = (int)(ReleaseTo(split, rest) - ReleaseFrom(split));
+                chunk->released += ((FreeBlock*)split)->released;
+                arena->committed -= ((FreeBlock*)split)->released;
+            }
+            found = size;
+        } else if (ptr + found < end) {
+            BLOCK_SIZE(ptr + found + SizeOfPointer) &= ~ARENA_PREV_FREE;
         }
-        data += *size + SizeOfPointer;
-        index += *size + SizeOfPointer;
+        SetDefinition(ptr - SizeOfPointer, typeID, found, chunk);
+        chunk->size += found + SizeOfPointer;
+        arena->size += found + SizeOfPointer;
+        return ptr;
     }
-    return -1;
+    return NULL;
 }
 
 void* RegionAlloc(Region* region, int size, int typeID) {
-    void* ptr = NULL;
-    if (region->offset + size + SizeOfPointer < region->capacity) {
-        return AllocPointer(region, size, typeID);
+    Region* owner = region->owner;
+    void* ptr = BinAlloc(owner, size, typeID);
+    if (ptr) return ptr;
+    Region* chunk = owner->tail;
+    if (chunk->offset + size + SizeOfPointer <= chunk->capacity) {
+        return AllocPointer(chunk, size, typeID);
     }
-    if (region->children) {
-        for (int i = 0; i < region->children_size; i++) {
-            ptr = RegionAlloc(region->children[i], size, typeID);
-            if (ptr) return ptr;
-        }
+    return NULL;
+}
+
+void RegionFree(Region* region, void* ptr, int size);
+
+void* ArenaMap(size_t length) {
+#if defined(_WIN32)
+    return calloc(1, length);
+#else
+    void* data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return data == MAP_FAILED ? NULL : data;
+#endif
+}
+
+void ArenaUnmap(void* data, size_t length) {
+#if defined(_WIN32)
+    free(data);
+#else
+    munmap(data, length);
+#endif
+}
+
+// maps a block of its own, linked to the owner region; fresh pages
+// are already zeroed
+void* HugeAlloc(Region* owner, int size, int typeID) {
+    size_t length = (size_t)HUGE_OFFSET + size;
+    HugeBlock* block = (HugeBlock*)ArenaMap(length);
+    if (block == NULL) return NULL;
+    block->length = length;
+    block->prev = NULL;
+    block->next = owner->huge;
+    if (block->next) block->next->prev = block;
+    owner->huge = block;
+    char* ptr = (char*)block + HUGE_OFFSET;
+    SetDefinition(ptr - SizeOfPointer, typeID, size, owner);
+    BLOCK_MAGIC(ptr) = HugeZone;
+    arena->size += (int)length;
+    arena->committed += length;
+    return ptr;
+}
+
+void HugeFree(void* ptr) {
+    HugeBlock* block = (HugeBlock*)((char*)ptr - HUGE_OFFSET);
+    Region* owner = BLOCK_REGION(ptr);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        owner->huge = block->next;
+    }
+    if (block->next) block->next->prev = block->prev;
+    arena->size -= (int)block->length;
+    arena->committed -= block->length;
+    ArenaUnmap(block, block->length);
+}
+
+void HugeClose(Region* owner) {
+    HugeBlock* block = owner->huge;
+    while (block) {
+        HugeBlock* next = block->next;
+        arena->size -= (int)block->length;
+        arena->committed -= block->length;
+        ArenaUnmap(block, block->length);
+        block = next;
     }
-    if (region->size + size + SizeOfPointer < region->capacity) {
-        int index = RegionFind(region, &size);
-        if (index >= 0) {
-            int temp = region->offset;
-            region->offset = index;
-            void* ptr = AllocPointer(region, size, typeID);
-            region->offset = temp + size + SizeOfPointer;
-            return ptr;
+    owner->huge = NULL;
+}
+
+#if !defined(__GNUC__) || defined(__TINYC__)
+void* ArenaExchange(void** ptr, void* value) {
+    void* old = *ptr;
+    *ptr = value;
+    return old;
+}
+#endif
+
+// only the magic and the region of a live block are read here, the
+// owning thread may be updating the prev-free bit of its size
+Arena* ArenaOwner(void* ptr) {
+    short magic = BLOCK_MAGIC(ptr);
+    if (magic != NormalZone && magic != HugeZone) return NULL;
+    Region* region = BLOCK_REGION(ptr);
+    if (region == NULL) return NULL;
+    return region->arena;
+}
+
+// called by the thread that frees a block it does not own
+void ArenaRemoteFree(Arena* owner, void* ptr) {
+    FreeBlock* block = (FreeBlock*)ptr;
+    FreeBlock* head = ARENA_LOAD(&owner->remote);
+    do {
+        block->next = head;
+    } while (!ARENA_CAS(&owner->remote, &head, block));
+}
+
+// takes the whole remote queue at once and frees it on the owning thread
+void ArenaCollect(Arena* owner) {
+    FreeBlock* block = (FreeBlock*)ARENA_EXCHANGE(&owner->remote, NULL);
+    while (block) {
+        FreeBlock* next = block->next;
+        if (BLOCK_MAGIC(block) == HugeZone) {
+            HugeFree(block);
+            block = next;
+            continue;
         }
+        int size = 0;
+        Region* region = GetRegion((char*)block, &size);
+        if (region) RegionFree(region, block, size);
+        block = next;
     }
-    return NULL;
 }
 
+#if defined(ARENA_ORPHANS)
+// arenas of ended threads that still had live blocks; the next thread
+// that needs an arena adopts one, with what was freed to it meanwhile
+static Arena* ArenaOrphans = NULL;
+static pthread_mutex_t ArenaOrphansLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ArenaKey;
+static pthread_once_t ArenaKeyOnce = PTHREAD_ONCE_INIT;
+
+void ArenaRetire(void* value);
+void ArenaKeyCreate(void) { pthread_key_create(&ArenaKey, ArenaRetire); }
+
+Arena* ArenaAdopt() {
+    pthread_once(&ArenaKeyOnce, ArenaKeyCreate);
+    pthread_mutex_lock(&ArenaOrphansLock);
+    Arena* orphan = ArenaOrphans;
+    if (orphan) ArenaOrphans = orphan->next;
+    pthread_mutex_unlock(&ArenaOrphansLock);
+    if (orphan) orphan->next = NULL;
+    return orphan;
+}
+#endif
+
 void ArenaInit(int initial_capacity) {
     if (arena != NULL) return;
+#if defined(ARENA_ORPHANS)
+    arena = ArenaAdopt();
+    if (arena) {
+        ArenaCollect(arena);
+        pthread_setspecific(ArenaKey, arena);
+        return;
+    }
+#endif
 
     arena = (Arena*)Allocate(sizeof(Arena));
     arena->size = 0;
+    arena->remote = NULL;
+    arena->next = NULL;
+    arena->committed = sizeof(Arena);
+    arena->retained = 0;
+    arena->epoch = 0;
 
-    arena->capacity = Align(initial_capacity, 4);
+    arena->capacity = Align(initial_capacity, ARENA_ALIGN);
     arena->region = RegionNew(initial_capacity);
+#if defined(ARENA_ORPHANS)
+    pthread_setspecific(ArenaKey, arena);
+#endif
 }
 
 void ArenaClose() {
+    if (arena == NULL) return;
+    ArenaCollect(arena);
     RegionClose(arena->region);
-    arena->size = 0;
-    arena->region->size = 0;
+    Free(arena);
+    arena = NULL;
+#if defined(ARENA_ORPHANS)
+    pthread_setspecific(ArenaKey, NULL);
+#endif
 }
 
-void SetDefinition(void* ptr, int typeID, int size, Region* region) {
-    char* data = (char*)ptr;
-    *((int*)data) = typeID;
-    data += sizeof(int);
-    *((int*)data) = size;
-    data += sizeof(int);
-    *((Region**)data) = region;
-    data += sizeof(Region*);
-    if (region) {
-        *((short*)data) = NormalZone;
-    } else {
-        *((short*)data) = ScopeZone;
+#if defined(ARENA_ORPHANS)
+// runs when a thread ends without closing its arena: with nothing live
+// left it is closed, otherwise it joins the orphans and other threads
+// keep freeing into its remote queue
+void ArenaRetire(void* value) {
+    arena = (Arena*)value;
+    ArenaCollect(arena);
+    if (arena->size == 0) {
+        ArenaClose();
+        return;
     }
+    pthread_mutex_lock(&ArenaOrphansLock);
+    arena->next = ArenaOrphans;
+    ArenaOrphans = arena;
+    pthread_mutex_unlock(&ArenaOrphansLock);
+    arena = NULL;
+}
+#endif
+
+void SetDefinition(void* ptr, int typeID, int size, Region* region) {
+    BlockHeader* header = (BlockHeader*)ptr;
+    header->region = region;
+    header->size = size;
+    header->typeID = (uint16_t)typeID;
+    header->magic = region ? NormalZone : ScopeZone;
 }
 
 bool GetDefinition(void* ptr, int* typeID, int* size, Region* region) {
-    char* data = (char*)ptr;
-    data -= sizeof(short);
-    short magic = *((short*)data);
-    if (magic < FreeZone || magic > ScopeZone) {
-        printf("Magic number is not correct: %d\n", magic);
+    (void)region;
+    BlockHeader* header = BLOCK_HEADER(ptr);
+    if (header->magic < FreeZone || header->magic > AlignedZone) {
+        printf("Magic number is not correct: %d\n", header->magic);
         return false;
     }
-    if (magic == NormalZone) {
-        data -= sizeof(Region*);
-        if (region) region = ((Region*)data);
-    }
-    data -= sizeof(int);
-    if (size) *size = *((int*)data);
-    data -= sizeof(int);
-    if (typeID) *typeID = *((int*)data);
+    if (size) *size = header->size & ~ARENA_PREV_FREE;
+    if (typeID) *typeID = header->typeID;
     return true;
 }
 
 Region* GetRegion(char* ptr, int* size) {
     char* backup = ptr;
-    ptr -= sizeof(short);
-    short mn = *((short*)ptr);
-    if ((mn & NormalZone) == 0) {
-        printf("Magic number wrong: %d\n", mn);
+    BlockHeader* header = BLOCK_HEADER(ptr);
+    if (header->magic != NormalZone) {
+        printf("Magic number wrong: %d\n", header->magic);
         return NULL;
     }
-    ptr -= sizeof(Region*);
-    Region* region = *((Region**)ptr);
+    Region* region = header->region;
     if (region == NULL) {
         printf("Region is null\n");
         return NULL;
     }
-    ptr -= sizeof(int);
-    if (size) *size = *((int*)ptr);
+    if (size) *size = header->size & ~ARENA_PREV_FREE;
     if (backup >= region->data && backup < (region->data + region->capacity)) {
         return region;
     }
-    if (backup) printf("ptr: %d\n", backup);
+    if (backup) printf("ptr: %p\n", backup);
     if (region) {
-        printf("region->data: %d\n", region->data);
+        printf("region->data: %p\n", region->data);
         printf("region->size: %d\n", region->size);
     }
     return NULL;
 }
 
 void* ArenaAlloc(int size, void* context, int typeID) {
+    if (arena == NULL) ArenaInit(ARENA_CAPACITY);
+    if (ARENA_LOAD(&arena->remote)) ArenaCollect(arena);
     Region* region = arena->region;
-    if (context && *(short*)context == RegionZone) {
+    if (context && *(short*)context == RegionZone && ((Region*)context)->arena == arena) {
         region = (Region*)context;
     }
+    if (size >= ARENA_HUGE) return HugeAlloc(region->owner, size, typeID);
+    int index = SizeClass(size);
+    if (ClassSize(index) >= size) size = ClassSize(index);
+    size = Align(size, ARENA_ALIGN);
     void* ptr = RegionAlloc(region, size, typeID);
     if (ptr == NULL) {
-        Region* new_region = RegionAdd(region, size);
-        if (new_region == NULL) return NULL;
-        ptr = RegionAlloc(new_region, size, typeID);
+        Region* chunk = RegionGrow(region->owner, size);
+        if (chunk == NULL) return NULL;
+        ptr = AllocPointer(chunk, size, typeID);
     }
     if (ptr) {
         memset(ptr, 0, size);
@@ -288,18 +741,56 @@ void* ArenaAlloc(int size, void* context, int typeID) {
     return ptr;
 }
 
+// merges the block with its free neighbours, then either gives the space
+// back to the top of the tail or keeps it in the region bins. Only the
+// tail takes bump allocations, a chunk behind it closes once it is empty
 void RegionFree(Region* region, void* ptr, int size) {
-    ptr -= sizeof(short);
-    *((short*)ptr) = FreeZone;
-    int subtract = size + SizeOfPointer;
-    if (subtract > region->size) {
-        subtract = region->size;
+    char* data = (char*)ptr;
+    Region* owner = region->owner;
+    bool prevFree = (BLOCK_SIZE(data) & ARENA_PREV_FREE) != 0;
+    char* end = region->data + region->offset;
+    region->size -= size + SizeOfPointer;
+    arena->size -= size + SizeOfPointer;
+    int released = 0;
+
+    char* next = data + size + SizeOfPointer;
+    if (data + size < end && BLOCK_MAGIC(next) == FreeZone) {
+        int nextSize = BLOCK_SIZE(next) & ~ARENA_PREV_FREE;
+        BinRemove(owner, next, nextSize);
+        released += ((FreeBlock*)next)->released;
+        size += nextSize + SizeOfPointer;
     }
-    if (region->offset == region->size) {
-        region->offset -= subtract;
+    if (prevFree) {
+        int prevSize = *((int*)(data - SizeOfPointer - sizeof(int)));
+        char* prev = data - SizeOfPointer - prevSize;
+        BinRemove(owner, prev, prevSize);
+        released += ((FreeBlock*)prev)->released;
+        size += prevSize + SizeOfPointer;
+        data = prev;
     }
-    region->size -= subtract;
-    arena->size -= subtract;
+    if (data + size >= end) {
+        if (region == owner->tail) {
+            region->offset = (int)(data - SizeOfPointer - region->data);
+            region->released -= released;
+            arena->committed += released;
+            return;
+        }
+        if (region != owner && data - SizeOfPointer == region->data) {
+            RegionClose(region);
+            return;
+        }
+    }
+    BLOCK_SIZE(data) = size;
+    BLOCK_MAGIC(data) = FreeZone;
+    BinPush(owner, data, size);
+    // a merged block keeps the pages its neighbours had released
+    ((FreeBlock*)data)->released = released;
+    ((FreeBlock*)data)->epoch = arena->epoch;
+    if (data + size < end) BLOCK_SIZE(data + size + SizeOfPointer) |= ARENA_PREV_FREE;
+    long idle = arena->committed - arena->size;
+    long slack = arena->size / 2 > ARENA_SLACK ? arena->size / 2 : ARENA_SLACK;
+    if (idle < arena->retained) arena->retained = idle;
+    if (idle - arena->retained > slack) ArenaTrim(owner);
 }
 
 bool Valid(void* ptr) {
@@ -308,8 +799,20 @@ bool Valid(void* ptr) {
 }
 
 bool ArenaFree(void* ptr) {
-    if (!Valid(ptr)) return false;
-    printf("Freeing %d\n", arena->size);
+    // like free, deleting null does nothing
+    if (ptr == NULL || !Valid(ptr)) return false;
+    if (BLOCK_MAGIC(ptr) == AlignedZone) ptr = (char*)ptr - BLOCK_SIZE(ptr);
+    // scope blocks go away with the frame that holds them
+    if (BLOCK_MAGIC(ptr) == ScopeZone) return true;
+    Arena* owner = ArenaOwner(ptr);
+    if (owner && owner != arena) {
+        ArenaRemoteFree(owner, ptr);
+        return true;
+    }
+    if (BLOCK_MAGIC(ptr) == HugeZone) {
+        HugeFree(ptr);
+        return true;
+    }
     int size = 0;
     Region* region = GetRegion((char*)ptr, &size);
     if (region == NULL) return false;
@@ -318,23 +821,44 @@ bool ArenaFree(void* ptr) {
     return true;
 }
 
-bool ArenaIS(void* ptr, int id) {
-    if (!Valid(ptr)) {
-        return false;
+// type of an arena or scope block read straight from its header,
+// -1 for anything the arena did not hand out. An any may hold a small
+// number instead of an object, nothing lives in the first page
+int ArenaTypeOf(void* ptr) {
+    if ((uintptr_t)ptr < 4096 || !Valid(ptr)) return -1;
+    short magic = BLOCK_MAGIC(ptr);
+    if (magic == NormalZone || magic == HugeZone || magic == ScopeZone || magic == AlignedZone) {
+        return BLOCK_HEADER(ptr)->typeID;
     }
-    int typeID = 0;
-    if (GetDefinition(ptr, &typeID, 0, 0) == false) return false;
-    return typeID == id;
+    return -1;
 }
 
-void* ArenaScope(int size, int typeID) {
-    void* ptr = alloca(size + (SizeOfPointer - sizeof(Region*)));
-    if (ptr == NULL) {
-        puts("Failed to allocate scope memory");
-        return NULL;
-    }
-    SetDefinition(ptr, typeID, size, NULL);
-    return (void*)(ptr + (SizeOfPointer - sizeof(Region*)));
+bool ArenaIS(void* ptr, int id) {
+    int typeID = ArenaTypeOf(ptr);
+    return typeID >= 0 && typeID == id;
+}
+
+// gives a header to storage in the caller frame, see SCOPE
+void* ArenaScope(void* ptr, int size, int typeID) {
+    SetDefinition((char*)ptr - SizeOfPointer, typeID, size, NULL);
+    return ptr;
+}
+
+// for alignments past ARENA_ALIGN the block is over-allocated and the
+// payload moved up to the boundary; the header written there keeps the
+// type and region and, in its size, the distance back to the real block
+void* ArenaAllocAligned(int size, int align, void* context, int typeID) {
+    if (align <= ARENA_ALIGN) return ArenaAlloc(size, context, typeID);
+    char* ptr = (char*)ArenaAlloc(size + align - ARENA_ALIGN, context, typeID);
+    if (ptr == NULL) return NULL;
+    char* aligned = (char*)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+    if (aligned == ptr) return ptr;
+    BlockHeader* header = BLOCK_HEADER(aligned);
+    header->region = BLOCK_REGION(ptr);
+    header->size = (int)(aligned - ptr);
+    header->typeID = (uint16_t)typeID;
+    header->magic = AlignedZone;
+    return aligned;
 }
 
 // int main() {
@@ -352,7 +876,8 @@ void* ArenaScope(int size, int typeID) {
 //     }
 //     ArenaFree(ptr);
 //   }
-//   void* scope = ArenaScope(100, 10);
+//   int64_t buffer[16] = {0};
+//   void* scope = ArenaScope(buffer + 2, 100, 10);
 //   if (ArenaIS(scope, 10) == false) {
 //     puts("Failed to check scope type");
 //   }
@@ -360,4 +885,4 @@ void* ArenaScope(int size, int typeID) {
 //   ArenaClose();
 //   puts("Done");
 //   return 0;
-// }
\ No newline at end of file
+// }
@@ -0,0 +1,22 @@
+#ifndef RUN_ATOMIC_H
+#define RUN_ATOMIC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// the memory orders for lib/atomic.run. Natives are written as calls, these
+// keep them constants so the C compiler emits the order asked for
+#define AtomicRelaxed() memory_order_relaxed
+#define AtomicConsume() memory_order_consume
+#define AtomicAcquire() memory_order_acquire
+#define AtomicRelease() memory_order_release
+#define AtomicAcqRel() memory_order_acq_rel
+#define AtomicSeqCst() memory_order_seq_cst
+
+// compare and swap of a reference, Run can't take the address of a local
+// reference, so the expected one is passed by value and not written back
+static inline bool AtomicSwapPointer(void* target, void* expected, void* desired, int success, int failure) {
+    return atomic_compare_exchange_strong_explicit((_Atomic(void*)*)target, &expected, desired, success, failure);
+}
+
+#endif
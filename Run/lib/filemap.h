@@ -0,0 +1,96 @@
+#ifndef RUN_FILEMAP_H
+#define RUN_FILEMAP_H
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// a whole file in memory for FileReader in MAPPED mode. Regular files are
+// mapped read only and read ahead sequentially; pipes, empty files and
+// Windows get one read into a buffer of their own. Reads hand out
+// pointers into it and only move the cursor, nothing is copied; the
+// pointers are good until FileMapClose
+typedef struct FileMap {
+    char* data;
+    long long size;
+    long long offset;
+    int mapped;
+} FileMap;
+
+static FileMap* FileMapOpen(FILE* fp) {
+    if (fp == NULL) return NULL;
+    FileMap* map = (FileMap*)calloc(1, sizeof(FileMap));
+    if (map == NULL) return NULL;
+#if !defined(_WIN32)
+    struct stat info;
+    int fd = fileno(fp);
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+#if defined(MADV_SEQUENTIAL)
+            madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+#endif
+            map->data = (char*)data;
+            map->size = info.st_size;
+            map->mapped = 1;
+            return map;
+        }
+    }
+#endif
+    long long capacity = 0;
+    for (;;) {
+        if (map->size == capacity) {
+            capacity = capacity ? capacity * 2 : 65536;
+            char* data = (char*)realloc(map->data, (size_t)capacity);
+            if (data == NULL) break;
+            map->data = data;
+        }
+        size_t n = fread(map->data + map->size, 1, (size_t)(capacity - map->size), fp);
+        if (n == 0) break;
+        map->size += (long long)n;
+    }
+    return map;
+}
+
+// length bytes at the cursor, NULL once they aren't all there
+static void* FileMapRead(FileMap* map, int length) {
+    if (map == NULL || length < 0 || map->size - map->offset < length) return NULL;
+    void* data = map->data + map->offset;
+    map->offset += length;
+    return data;
+}
+
+static void* FileMapData(FileMap* map) {
+    return map ? map->data : NULL;
+}
+
+static long long FileMapSize(FileMap* map) {
+    return map ? map->size : 0;
+}
+
+// strings hold an int size, a whole file past it can't be one and gets
+// -1; larger files are read in parts
+static int FileMapStringSize(FileMap* map) {
+    long long size = FileMapSize(map);
+    return size > INT_MAX ? -1 : (int)size;
+}
+
+static void FileMapClose(FileMap* map) {
+    if (map == NULL) return;
+#if !defined(_WIN32)
+    if (map->mapped) {
+        munmap(map->data, (size_t)map->size);
+        free(map);
+        return;
+    }
+#endif
+    free(map->data);
+    free(map);
+}
+
+#endif
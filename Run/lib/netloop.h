@@ -0,0 +1,363 @@
+#ifndef RUN_NETLOOP_H
+#define RUN_NETLOOP_H
+
+#if !defined(__linux__)
+#error "lib/net runs on epoll, it needs Linux"
+#endif
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// non-blocking TCP sockets on one epoll loop. NetLoopWait does the I/O:
+// readable sockets are drained into their read buffer, listeners accept
+// everything waiting in one batch, writable ones send what they still
+// hold. Writes go straight to the socket while nothing is queued and only
+// the part that didn't fit is copied. The loop is level triggered,
+// EPOLLOUT is watched only while there is something to send
+
+#define NET_EVENTS 256
+#define NET_ACCEPT_BATCH 64
+#define NET_READ_CHUNK 16384
+
+// state
+#define NET_CONNECTING 1
+#define NET_OPEN 2
+#define NET_CLOSED 3
+
+// what the last wait found
+#define NET_READABLE 1
+#define NET_WRITABLE 2
+#define NET_HANGUP 4
+
+typedef struct NetBuffer {
+    char* data;
+    int start;
+    int end;
+    int capacity;
+} NetBuffer;
+
+typedef struct NetLoop NetLoop;
+
+typedef struct NetSocket {
+    int fd;
+    int state;
+    int ready;
+    int listening;
+    unsigned watched;
+    NetLoop* loop;
+    void* owner;
+    NetBuffer in;
+    NetBuffer out;
+    int accepted[NET_ACCEPT_BATCH];
+    int acceptedStart;
+    int acceptedCount;
+} NetSocket;
+
+struct NetLoop {
+    int fd;
+    int count;
+    struct epoll_event events[NET_EVENTS];
+};
+
+static int NetReserve(NetBuffer* buffer, int size) {
+    if (buffer->start == buffer->end) buffer->start = buffer->end = 0;
+    if (buffer->capacity - buffer->end >= size) return 1;
+    if (buffer->start > 0) {
+        memmove(buffer->data, buffer->data + buffer->start, buffer->end - buffer->start);
+        buffer->end -= buffer->start;
+        buffer->start = 0;
+        if (buffer->capacity - buffer->end >= size) return 1;
+    }
+    int capacity = buffer->capacity ? buffer->capacity : NET_READ_CHUNK;
+    while (capacity - buffer->end < size) capacity *= 2;
+    char* data = (char*)realloc(buffer->data, capacity);
+    if (data == NULL) return 0;
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 1;
+}
+
+static NetSocket* NetWrap(int fd, int state) {
+    NetSocket* socket = (NetSocket*)calloc(1, sizeof(NetSocket));
+    if (socket == NULL) {
+        close(fd);
+        return NULL;
+    }
+    socket->fd = fd;
+    socket->state = state;
+    return socket;
+}
+
+static int NetAddress(const char* ip, int port, struct sockaddr_in* address) {
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port = htons((unsigned short)port);
+    if (ip == NULL || *ip == 0) {
+        address->sin_addr.s_addr = htonl(INADDR_ANY);
+        return 1;
+    }
+    return inet_pton(AF_INET, ip, &address->sin_addr) == 1;
+}
+
+// keeps EPOLLOUT registered exactly while the socket has to send or connect
+static void NetWatch(NetSocket* socket) {
+    if (socket->loop == NULL || socket->state == NET_CLOSED) return;
+    unsigned events = EPOLLIN | EPOLLRDHUP;
+    if (socket->state == NET_CONNECTING || socket->out.end > socket->out.start) events |= EPOLLOUT;
+    if (events == socket->watched) return;
+    struct epoll_event event = {.events = events, .data.ptr = socket};
+    epoll_ctl(socket->loop->fd, EPOLL_CTL_MOD, socket->fd, &event);
+    socket->watched = events;
+}
+
+static NetSocket* NetConnect(const char* ip, int port) {
+    struct sockaddr_in address;
+    if (NetAddress(ip, port, &address) == 0) return NULL;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int state = NET_OPEN;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        if (errno != EINPROGRESS) {
+            close(fd);
+            return NULL;
+        }
+        state = NET_CONNECTING;
+    }
+    return NetWrap(fd, state);
+}
+
+// with reuse port every thread or process can have its own listener on
+// the same port, the kernel spreads the connections over them
+static NetSocket* NetListen(const char* ip, int port, int backlog, int reusePort) {
+    struct sockaddr_in address;
+    if (NetAddress(ip, port, &address) == 0) return NULL;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#if defined(SO_REUSEPORT)
+    if (reusePort) setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(fd, backlog) < 0) {
+        close(fd);
+        return NULL;
+    }
+    NetSocket* socket = NetWrap(fd, NET_OPEN);
+    if (socket) socket->listening = 1;
+    return socket;
+}
+
+static int NetPort(NetSocket* socket) {
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    if (socket == NULL || getsockname(socket->fd, (struct sockaddr*)&address, &length) < 0) return -1;
+    return ntohs(address.sin_port);
+}
+
+static void NetAcceptBatch(NetSocket* listener) {
+    listener->acceptedStart = 0;
+    listener->acceptedCount = 0;
+    while (listener->acceptedCount < NET_ACCEPT_BATCH) {
+        int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        listener->accepted[listener->acceptedCount++] = fd;
+    }
+}
+
+// the next connection of the last batch, a new batch when it ran out
+static NetSocket* NetAccept(NetSocket* listener) {
+    if (listener == NULL || listener->listening == 0) return NULL;
+    if (listener->acceptedStart == listener->acceptedCount) NetAcceptBatch(listener);
+    if (listener->acceptedStart == listener->acceptedCount) return NULL;
+    return NetWrap(listener->accepted[listener->acceptedStart++], NET_OPEN);
+}
+
+static void NetFail(NetSocket* socket) {
+    socket->state = NET_CLOSED;
+    socket->ready |= NET_HANGUP;
+}
+
+static int NetFill(NetSocket* socket) {
+    int total = 0;
+    while (socket->state == NET_OPEN) {
+        if (NetReserve(&socket->in, NET_READ_CHUNK) == 0) break;
+        ssize_t n = recv(socket->fd, socket->in.data + socket->in.end, socket->in.capacity - socket->in.end, 0);
+        if (n > 0) {
+            socket->in.end += (int)n;
+            total += (int)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        NetFail(socket);
+    }
+    return total;
+}
+
+static void NetSend(NetSocket* socket) {
+    NetBuffer* out = &socket->out;
+    while (socket->state == NET_OPEN && out->start < out->end) {
+        ssize_t n = send(socket->fd, out->data + out->start, out->end - out->start, MSG_NOSIGNAL);
+        if (n > 0) {
+            out->start += (int)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        NetFail(socket);
+    }
+    if (out->start == out->end) out->start = out->end = 0;
+}
+
+static int NetWrite(NetSocket* socket, const void* data, int start, int size) {
+    if (socket == NULL || socket->state == NET_CLOSED || size < 0) return 0;
+    const char* bytes = (const char*)data + start;
+    if (socket->state == NET_OPEN && socket->out.start == socket->out.end) {
+        while (size > 0) {
+            ssize_t n = send(socket->fd, bytes, size, MSG_NOSIGNAL);
+            if (n > 0) {
+                bytes += n;
+                size -= (int)n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            NetFail(socket);
+            return 0;
+        }
+    }
+    if (size > 0) {
+        if (NetReserve(&socket->out, size) == 0) return 0;
+        memcpy(socket->out.data + socket->out.end, bytes, size);
+        socket->out.end += size;
+    }
+    NetWatch(socket);
+    return 1;
+}
+
+static int NetAvailable(NetSocket* socket) {
+    return socket ? socket->in.end - socket->in.start : 0;
+}
+
+static int NetPending(NetSocket* socket) {
+    return socket ? socket->out.end - socket->out.start : 0;
+}
+
+// copies up to size read bytes out and drops them from the buffer
+static int NetTake(NetSocket* socket, void* data, int size) {
+    int count = NetAvailable(socket);
+    if (size < count) count = size;
+    if (count <= 0) return 0;
+    memcpy(data, socket->in.data + socket->in.start, count);
+    socket->in.start += count;
+    return count;
+}
+
+static int NetState(NetSocket* socket) {
+    return socket ? socket->state : NET_CLOSED;
+}
+
+static int NetListening(NetSocket* socket) {
+    return socket && socket->listening;
+}
+
+static int NetReady(NetSocket* socket, int flag) {
+    return socket && (socket->ready & flag) != 0;
+}
+
+static void NetClose(NetSocket* socket) {
+    if (socket == NULL) return;
+    if (socket->loop) epoll_ctl(socket->loop->fd, EPOLL_CTL_DEL, socket->fd, NULL);
+    for (int i = socket->acceptedStart; i < socket->acceptedCount; i++) close(socket->accepted[i]);
+    close(socket->fd);
+    free(socket->in.data);
+    free(socket->out.data);
+    free(socket);
+}
+
+static NetLoop* NetLoopNew(void) {
+    NetLoop* loop = (NetLoop*)calloc(1, sizeof(NetLoop));
+    if (loop == NULL) return NULL;
+    loop->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->fd < 0) {
+        free(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+// owner is what NetLoopOwner gives back for the socket
+static int NetLoopAdd(NetLoop* loop, NetSocket* socket, void* owner) {
+    if (loop == NULL || socket == NULL || socket->loop) return 0;
+    socket->loop = loop;
+    socket->owner = owner;
+    socket->watched = EPOLLIN | EPOLLRDHUP;
+    if (socket->state == NET_CONNECTING || NetPending(socket) > 0) socket->watched |= EPOLLOUT;
+    struct epoll_event event = {.events = socket->watched, .data.ptr = socket};
+    if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, socket->fd, &event) == 0) return 1;
+    socket->loop = NULL;
+    return 0;
+}
+
+static int NetLoopWait(NetLoop* loop, int timeout) {
+    if (loop == NULL) return 0;
+    int count;
+    do {
+        count = epoll_wait(loop->fd, loop->events, NET_EVENTS, timeout);
+    } while (count < 0 && errno == EINTR);
+    loop->count = count < 0 ? 0 : count;
+    for (int i = 0; i < loop->count; i++) {
+        NetSocket* socket = (NetSocket*)loop->events[i].data.ptr;
+        unsigned events = loop->events[i].events;
+        socket->ready = 0;
+        if ((events & EPOLLOUT) && socket->state == NET_CONNECTING) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(socket->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error) NetFail(socket);
+            else socket->state = NET_OPEN;
+        }
+        if (events & EPOLLOUT) {
+            NetSend(socket);
+            if (socket->state == NET_OPEN) socket->ready |= NET_WRITABLE;
+        }
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            if (socket->listening) {
+                if (socket->acceptedStart == socket->acceptedCount) NetAcceptBatch(socket);
+            } else {
+                NetFill(socket);
+            }
+            if (socket->listening || NetAvailable(socket) > 0) socket->ready |= NET_READABLE;
+        }
+        if (events & (EPOLLHUP | EPOLLERR)) NetFail(socket);
+        NetWatch(socket);
+    }
+    return loop->count;
+}
+
+static void* NetLoopOwner(NetLoop* loop, int index) {
+    if (loop == NULL || index < 0 || index >= loop->count) return NULL;
+    return ((NetSocket*)loop->events[index].data.ptr)->owner;
+}
+
+static void NetLoopClose(NetLoop* loop) {
+    if (loop == NULL) return;
+    close(loop->fd);
+    free(loop);
+}
+
+#endif
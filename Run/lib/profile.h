@@ -0,0 +1,253 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// allocation profiler, included instead of plain NEW and DELETE when a
+// program is compiled with --profile-alloc. Lifetimes are measured in
+// allocations made while the object was alive, which is deterministic
+// and costs nothing to read. The tables are not locked, so only
+// allocations of single threaded programs are counted reliably.
+
+// lifetime buckets: < 16, < 256, < 4K, < 64K, < 1M and longer
+#define PROFILE_BUCKETS 6
+
+typedef struct ProfileSite {
+    const char* path;
+    int line;
+} ProfileSite;
+
+typedef struct ProfileStats {
+    int64_t count;
+    int64_t bytes;
+    int64_t live;
+    int64_t peak;
+    int64_t lifetimes[PROFILE_BUCKETS];
+} ProfileStats;
+
+typedef struct ProfileEntry {
+    void* ptr;
+    int size;
+    int type;
+    int site;
+    uint64_t tick;
+} ProfileEntry;
+
+typedef struct Profile {
+    uint64_t tick;
+    ProfileEntry* entries;
+    int size;
+    int capacity;
+    ProfileStats* types;
+    int types_capacity;
+    ProfileStats* sites;
+    int sites_capacity;
+} Profile;
+
+static Profile profile = {0};
+
+ProfileStats* ProfileStatsAt(ProfileStats** stats, int* capacity, int index) {
+    if (index < 0) index = 0;
+    if (index >= *capacity) {
+        int old = *capacity;
+        int grown = old ? old : 64;
+        while (grown <= index) grown *= 2;
+        *stats = (ProfileStats*)realloc(*stats, sizeof(ProfileStats) * grown);
+        if (*stats == NULL) {
+            puts("Failed to allocate memory for profile");
+            exit(-1);
+        }
+        memset(*stats + old, 0, sizeof(ProfileStats) * (grown - old));
+        *capacity = grown;
+    }
+    return *stats + index;
+}
+
+static inline uint64_t ProfileHash(void* ptr) {
+    uint64_t key = (uint64_t)(uintptr_t)ptr;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return key;
+}
+
+// linear probing over live blocks, kept under half full
+ProfileEntry* ProfileFind(void* ptr) {
+    if (profile.capacity == 0) return NULL;
+    int mask = profile.capacity - 1;
+    int index = (int)(ProfileHash(ptr) & mask);
+    while (profile.entries[index].ptr) {
+        if (profile.entries[index].ptr == ptr) return profile.entries + index;
+        index = (index + 1) & mask;
+    }
+    return NULL;
+}
+
+void ProfileInsert(ProfileEntry entry);
+
+void ProfileResize() {
+    ProfileEntry* old = profile.entries;
+    int capacity = profile.capacity;
+    profile.capacity = capacity ? capacity * 2 : 1024;
+    profile.entries = (ProfileEntry*)calloc(profile.capacity, sizeof(ProfileEntry));
+    if (profile.entries == NULL) {
+        puts("Failed to allocate memory for profile");
+        exit(-1);
+    }
+    profile.size = 0;
+    for (int i = 0; i < capacity; i++) {
+        if (old[i].ptr) ProfileInsert(old[i]);
+    }
+    free(old);
+}
+
+void ProfileInsert(ProfileEntry entry) {
+    if ((profile.size + 1) * 2 > profile.capacity) ProfileResize();
+    int mask = profile.capacity - 1;
+    int index = (int)(ProfileHash(entry.ptr) & mask);
+    while (profile.entries[index].ptr) index = (index + 1) & mask;
+    profile.entries[index] = entry;
+    profile.size++;
+}
+
+// backward shift deletion, so lookups never need tombstones
+void ProfileRemove(ProfileEntry* entry) {
+    int mask = profile.capacity - 1;
+    int hole = (int)(entry - profile.entries);
+    int index = (hole + 1) & mask;
+    while (profile.entries[index].ptr) {
+        int home = (int)(ProfileHash(profile.entries[index].ptr) & mask);
+        if (((index - home) & mask) >= ((index - hole) & mask)) {
+            profile.entries[hole] = profile.entries[index];
+            hole = index;
+        }
+        index = (index + 1) & mask;
+    }
+    profile.entries[hole].ptr = NULL;
+    profile.size--;
+}
+
+int ProfileBucket(uint64_t lifetime) {
+    int bucket = 0;
+    while (bucket < PROFILE_BUCKETS - 1 && lifetime >= (uint64_t)16 << (bucket * 4)) bucket++;
+    return bucket;
+}
+
+void ProfileRelease(ProfileStats* stats, int size, int bucket) {
+    stats->live -= size;
+    stats->lifetimes[bucket]++;
+}
+
+void ProfileEnd(ProfileEntry* entry) {
+    int bucket = ProfileBucket(profile.tick - entry->tick);
+    ProfileRelease(ProfileStatsAt(&profile.types, &profile.types_capacity, entry->type), entry->size, bucket);
+    ProfileRelease(ProfileStatsAt(&profile.sites, &profile.sites_capacity, entry->site), entry->size, bucket);
+    ProfileRemove(entry);
+}
+
+void ProfileAccount(ProfileStats* stats, int size) {
+    stats->count++;
+    stats->bytes += size;
+    stats->live += size;
+    if (stats->live > stats->peak) stats->peak = stats->live;
+}
+
+void* ProfileAlloc(void* ptr, int size, int type, int site) {
+    if (ptr == NULL) return NULL;
+    profile.tick++;
+    // the address was handed out again, so its last owner went away
+    // with a region without passing through DELETE
+    ProfileEntry* old = ProfileFind(ptr);
+    if (old) ProfileEnd(old);
+    ProfileAccount(ProfileStatsAt(&profile.types, &profile.types_capacity, type), size);
+    ProfileAccount(ProfileStatsAt(&profile.sites, &profile.sites_capacity, site), size);
+    ProfileEntry entry = {ptr, size, type, site, profile.tick};
+    ProfileInsert(entry);
+    return ptr;
+}
+
+void* ProfileNew(int size, int align, void* region, int type, int site) {
+    return ProfileAlloc(ArenaAllocAligned(size, align, region, type), size, type, site);
+}
+
+void ProfileFree(void* ptr) {
+    if (ptr == NULL) return;
+    ProfileEntry* entry = ProfileFind(ptr);
+    if (entry) ProfileEnd(entry);
+}
+
+static ProfileStats* profileSorted = NULL;
+
+int ProfileCompare(const void* a, const void* b) {
+    int64_t left = profileSorted[*(const int*)a].bytes;
+    int64_t right = profileSorted[*(const int*)b].bytes;
+    return left < right ? 1 : left > right ? -1 : 0;
+}
+
+void ProfilePrint(ProfileStats* stats, int count, const char* title, const char* (*name)(int, char*)) {
+    int* order = (int*)malloc(sizeof(int) * (count ? count : 1));
+    int used = 0;
+    for (int i = 0; i < count; i++) {
+        if (stats[i].count) order[used++] = i;
+    }
+    profileSorted = stats;
+    qsort(order, used, sizeof(int), ProfileCompare);
+    fprintf(stderr, "\n%-32s %10s %12s %12s %12s  %8s %8s %8s %8s %8s %8s\n", title, "count", "bytes", "peak live",
+            "live", "<16", "<256", "<4K", "<64K", "<1M", "more");
+    char buffer[256];
+    for (int i = 0; i < used; i++) {
+        ProfileStats* s = stats + order[i];
+        fprintf(stderr, "%-32s %10lld %12lld %12lld %12lld ", name(order[i], buffer), (long long)s->count,
+                (long long)s->bytes, (long long)s->peak, (long long)s->live);
+        for (int b = 0; b < PROFILE_BUCKETS; b++) {
+            fprintf(stderr, " %8lld", (long long)s->lifetimes[b]);
+        }
+        fputc('\n', stderr);
+    }
+    free(order);
+}
+
+static const ProfileSite* profileSites = NULL;
+static const char* (*profileTypeName)(int) = NULL;
+
+const char* ProfileTypeName(int id, char* buffer) {
+    const char* name = profileTypeName ? profileTypeName(id) : NULL;
+    if (name) return name;
+    snprintf(buffer, 256, "#%d", id);
+    return buffer;
+}
+
+const char* ProfileSiteName(int id, char* buffer) {
+    const ProfileSite* site = profileSites + id;
+    snprintf(buffer, 256, "%s:%d", site->path, site->line);
+    return buffer;
+}
+
+// lifetimes count allocations; blocks still live at exit are in "live"
+void ProfileReport(const ProfileSite* sites, int count, const char* (*typeName)(int)) {
+    profileSites = sites;
+    profileTypeName = typeName;
+    int types = profile.types_capacity;
+    int used = profile.sites_capacity < count ? profile.sites_capacity : count;
+    fprintf(stderr, "\nallocation profile, %llu allocations\n", (unsigned long long)profile.tick);
+    ProfilePrint(profile.types, types, "type", ProfileTypeName);
+    ProfilePrint(profile.sites, used, "line", ProfileSiteName);
+    free(profile.entries);
+    free(profile.types);
+    free(profile.sites);
+    memset(&profile, 0, sizeof(profile));
+}
+
+static int profileCount = 0;
+
+void ProfileExit(void) {
+    ProfileReport(profileSites, profileCount, profileTypeName);
+}
+
+// the report is printed when the program ends, by exit() as well
+void ProfileAtExit(const ProfileSite* sites, int count, const char* (*typeName)(int)) {
+    profileSites = sites;
+    profileCount = count;
+    profileTypeName = typeName;
+    atexit(ProfileExit);
+}
@@ -0,0 +1,187 @@
+#ifndef RUN_TEXT_H
+#define RUN_TEXT_H
+
+#include <stdint.h>
+#include <string.h>
+
+// byte string kernels behind string.run. AVX2 or SSE2 when the compiler
+// targets them (-march=native in release builds), plain C otherwise,
+// which is also what tcc gets. Every function gives the same result on
+// every path.
+
+#if defined(__AVX2__) && !defined(__TINYC__)
+#include <immintrin.h>
+#define TEXT_AVX2 1
+#elif defined(__SSE2__) && !defined(__TINYC__)
+#include <emmintrin.h>
+#define TEXT_SSE2 1
+#endif
+
+#if defined(__GNUC__) && !defined(__TINYC__)
+#define TEXT_CTZ(mask) __builtin_ctz(mask)
+#define TEXT_CLZ(mask) __builtin_clz(mask)
+#else
+static inline int TEXT_CTZ(unsigned mask) {
+    int n = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        n++;
+    }
+    return n;
+}
+static inline int TEXT_CLZ(unsigned mask) {
+    int n = 0;
+    while ((mask & 0x80000000u) == 0) {
+        mask <<= 1;
+        n++;
+    }
+    return n;
+}
+#endif
+
+// the length scan reads whole aligned vectors, which never cross into the
+// next page, but may read past the terminator inside the last one
+#if defined(__SANITIZE_ADDRESS__)
+#define TEXT_NO_SANITIZE __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define TEXT_NO_SANITIZE __attribute__((no_sanitize_address))
+#endif
+#endif
+#ifndef TEXT_NO_SANITIZE
+#define TEXT_NO_SANITIZE
+#endif
+
+TEXT_NO_SANITIZE static int TextLength(const char* text) {
+    if (text == NULL) return 0;
+#if defined(TEXT_AVX2) || defined(TEXT_SSE2)
+    const char* p = text;
+    while (((uintptr_t)p & 15) != 0) {
+        if (*p == 0) return (int)(p - text);
+        p++;
+    }
+    const __m128i zero = _mm_setzero_si128();
+    for (;; p += 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)p), zero));
+        if (mask) return (int)(p - text) + TEXT_CTZ(mask);
+    }
+#else
+    return (int)strlen(text);
+#endif
+}
+
+static int TextEquals(const char* a, const char* b, int size) {
+    if (a == b) return 1;
+    if (a == NULL || b == NULL) return size == 0;
+    int i = 0;
+#if defined(TEXT_AVX2)
+    for (; i + 32 <= size; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) != 0xFFFFFFFFu) return 0;
+    }
+#endif
+#if defined(TEXT_AVX2) || defined(TEXT_SSE2)
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) return 0;
+    }
+#endif
+    return memcmp(a + i, b + i, size - i) == 0;
+}
+
+// candidates are positions where both the first and the last byte of the
+// part match, only those are compared in full
+static int TextIndexOf(const char* text, int size, const char* part, int count, int from) {
+    if (from < 0) from = 0;
+    if (count <= 0) return from <= size ? from : -1;
+    if (text == NULL || part == NULL || count > size) return -1;
+    int last = size - count;
+    int i = from;
+#if defined(TEXT_AVX2)
+    const __m256i first32 = _mm256_set1_epi8(part[0]);
+    const __m256i end32 = _mm256_set1_epi8(part[count - 1]);
+    for (; i + 32 <= last + 1; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(text + i + count - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first32), _mm256_cmpeq_epi8(b, end32)));
+        while (mask) {
+            int at = i + TEXT_CTZ(mask);
+            if (memcmp(text + at + 1, part + 1, count - 1) == 0) return at;
+            mask &= mask - 1;
+        }
+    }
+#endif
+#if defined(TEXT_AVX2) || defined(TEXT_SSE2)
+    const __m128i first = _mm_set1_epi8(part[0]);
+    const __m128i end = _mm_set1_epi8(part[count - 1]);
+    for (; i + 16 <= last + 1; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(text + i + count - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, end)));
+        while (mask) {
+            int at = i + TEXT_CTZ(mask);
+            if (memcmp(text + at + 1, part + 1, count - 1) == 0) return at;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i <= last; i++) {
+        const char* found = (const char*)memchr(text + i, part[0], last - i + 1);
+        if (found == NULL) return -1;
+        i = (int)(found - text);
+        if (memcmp(found + 1, part + 1, count - 1) == 0) return i;
+    }
+    return -1;
+}
+
+// the last match starting at or before from
+static int TextLastIndexOf(const char* text, int size, const char* part, int count, int from) {
+    if (text == NULL || part == NULL || count > size) return -1;
+    if (from > size - count) from = size - count;
+    if (from < 0) return -1;
+    if (count <= 0) return from;
+    int i = from;
+#if defined(TEXT_AVX2) || defined(TEXT_SSE2)
+    const __m128i first = _mm_set1_epi8(part[0]);
+    const __m128i end = _mm_set1_epi8(part[count - 1]);
+    for (; i - 15 >= 0; i -= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(text + i - 15));
+        __m128i b = _mm_loadu_si128((const __m128i*)(text + i - 15 + count - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, end))) << 16;
+        while (mask) {
+            int at = i - TEXT_CLZ(mask);
+            if (memcmp(text + at + 1, part + 1, count - 1) == 0) return at;
+            mask &= ~(0x80000000u >> TEXT_CLZ(mask));
+        }
+    }
+#endif
+    for (; i >= 0; i--) {
+        if (text[i] == part[0] && memcmp(text + i + 1, part + 1, count - 1) == 0) return i;
+    }
+    return -1;
+}
+
+// 8 bytes per step with a multiply mix; not for anything adversarial.
+// -1 is left free, string uses it for a hash not computed yet
+static int TextHash(const char* text, int size) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ (uint64_t)size;
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, text + i, 8);
+        h = (h ^ word) * 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 31;
+    }
+    uint64_t tail = 0;
+    for (int shift = 0; i < size; i++, shift += 8) {
+        tail |= (uint64_t)(unsigned char)text[i] << shift;
+    }
+    h = (h ^ tail) * 0x94D049BB133111EBull;
+    h ^= h >> 29;
+    int hash = (int)(h ^ (h >> 32));
+    return hash == -1 ? 0x7FFFFFFF : hash;
+}
+
+#endif
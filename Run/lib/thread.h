@@ -0,0 +1,273 @@
+#ifndef RUN_THREAD_H
+#define RUN_THREAD_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+// threads, the task pool behind parallel for and per thread reductions.
+// Every worker owns a deque: it pushes and pops its own jobs at the
+// bottom, idle workers steal from the top of the others. A thread waiting
+// for its jobs runs or steals jobs instead of blocking, so parallel loops
+// may nest. Each thread allocates from its own arena, see arena.h
+
+#if defined(__GNUC__) && !defined(__TINYC__)
+#define THREAD_LOCAL __thread
+#define THREAD_ADD(ptr, value) __atomic_add_fetch(ptr, value, __ATOMIC_ACQ_REL)
+#define THREAD_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#else
+#error "lib/thread needs gcc or clang"
+#endif
+
+// jobs per worker a loop is cut into, so stealing can even out the load
+#define THREAD_SPLIT 4
+#define THREAD_DEQUE 256
+// padding that keeps per thread slots on their own cache line
+#define THREAD_LINE 64
+
+typedef void (*ThreadTask)(void* context, int start, int end);
+
+typedef struct ThreadJob {
+    ThreadTask task;
+    void* context;
+    int start;
+    int end;
+    int* remaining;
+} ThreadJob;
+
+typedef struct ThreadDeque {
+    pthread_mutex_t lock;
+    ThreadJob* jobs;
+    int top;
+    int bottom;
+    int capacity;
+    char padding[THREAD_LINE];
+} ThreadDeque;
+
+typedef struct ThreadPool {
+    int workers;
+    ThreadDeque* deques;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int queued;
+} ThreadPool;
+
+static ThreadPool* ThreadPoolInstance = NULL;
+static pthread_once_t ThreadPoolOnce = PTHREAD_ONCE_INIT;
+// 0 for threads outside the pool, the main one too, so they share it
+static THREAD_LOCAL int ThreadSlot = 0;
+
+static void ThreadPush(ThreadDeque* deque, ThreadJob job) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom == deque->capacity) {
+        int count = deque->bottom - deque->top;
+        if (deque->top > 0) {
+            memmove(deque->jobs, deque->jobs + deque->top, count * sizeof(ThreadJob));
+        } else {
+            deque->capacity = deque->capacity ? deque->capacity * 2 : THREAD_DEQUE;
+            deque->jobs = (ThreadJob*)realloc(deque->jobs, deque->capacity * sizeof(ThreadJob));
+        }
+        deque->top = 0;
+        deque->bottom = count;
+    }
+    deque->jobs[deque->bottom++] = job;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static int ThreadPop(ThreadDeque* deque, ThreadJob* job, int steal) {
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom) {
+        *job = steal ? deque->jobs[deque->top++] : deque->jobs[--deque->bottom];
+        if (deque->top == deque->bottom) deque->top = deque->bottom = 0;
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// own jobs first, newest first, then the oldest of someone else
+static int ThreadFind(ThreadPool* pool, ThreadJob* job) {
+    int count = pool->workers + 1;
+    if (ThreadPop(&pool->deques[ThreadSlot], job, 0)) return 1;
+    for (int i = 1; i < count; i++) {
+        if (ThreadPop(&pool->deques[(ThreadSlot + i) % count], job, 1)) return 1;
+    }
+    return 0;
+}
+
+static void ThreadRun(ThreadPool* pool, ThreadJob* job) {
+    THREAD_ADD(&pool->queued, -1);
+    job->task(job->context, job->start, job->end);
+    THREAD_ADD(job->remaining, -1);
+}
+
+static void* ThreadWorker(void* argument) {
+    ThreadPool* pool = ThreadPoolInstance;
+    ThreadSlot = (int)(intptr_t)argument;
+    ThreadJob job;
+    for (;;) {
+        if (ThreadFind(pool, &job)) {
+            ThreadRun(pool, &job);
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (THREAD_LOAD(&pool->queued) == 0) pthread_cond_wait(&pool->wake, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+// RUN_THREADS sets the number of threads a loop runs on, the cores otherwise
+static void ThreadPoolStart(void) {
+    ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    const char* setting = getenv("RUN_THREADS");
+    int threads = setting ? atoi(setting) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    pool->workers = threads > 1 ? threads - 1 : 0;
+    pool->deques = (ThreadDeque*)calloc(pool->workers + 1, sizeof(ThreadDeque));
+    for (int i = 0; i <= pool->workers; i++) pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    ThreadPoolInstance = pool;
+    for (int i = 1; i <= pool->workers; i++) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, ThreadWorker, (void*)(intptr_t)i);
+        pthread_detach(thread);
+    }
+}
+
+static ThreadPool* ThreadPoolGet(void) {
+    pthread_once(&ThreadPoolOnce, ThreadPoolStart);
+    return ThreadPoolInstance;
+}
+
+static int ThreadCount(void) {
+    return ThreadPoolGet()->workers + 1;
+}
+
+static int ThreadIndex(void) {
+    return ThreadSlot;
+}
+
+// runs task over [0, count) in parts on the pool and returns when all are done
+static void ThreadParallelFor(int count, ThreadTask task, void* context) {
+    if (count <= 0) return;
+    ThreadPool* pool = ThreadPoolGet();
+    int parts = (pool->workers + 1) * THREAD_SPLIT;
+    if (parts > count) parts = count;
+    if (pool->workers == 0 || parts == 1) {
+        task(context, 0, count);
+        return;
+    }
+    int remaining = parts;
+    int size = count / parts;
+    int extra = count % parts;
+    // the first part stays here, the rest can be stolen
+    int first = size + (extra > 0);
+    for (int i = 1, start = first; i < parts; i++) {
+        int end = start + size + (i < extra);
+        ThreadPush(&pool->deques[ThreadSlot], (ThreadJob){task, context, start, end, &remaining});
+        start = end;
+    }
+    THREAD_ADD(&pool->queued, parts - 1);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    task(context, 0, first);
+    THREAD_ADD(&remaining, -1);
+    ThreadJob job;
+    while (THREAD_LOAD(&remaining) > 0) {
+        if (ThreadFind(pool, &job)) ThreadRun(pool, &job);
+        else sched_yield();
+    }
+}
+
+// a sum per thread, each on its own cache line, added up when read. The
+// threads outside the pool all add to slot 0, atomically
+typedef struct ThreadReduction {
+    int slots;
+    char* values;
+} ThreadReduction;
+
+static ThreadReduction* ThreadReductionNew(void) {
+    ThreadReduction* reduction = (ThreadReduction*)malloc(sizeof(ThreadReduction));
+    reduction->slots = ThreadCount();
+    reduction->values = (char*)calloc(reduction->slots, THREAD_LINE);
+    return reduction;
+}
+
+static void ThreadReductionAdd(ThreadReduction* reduction, long long value) {
+    long long* slot = (long long*)(reduction->values + ThreadSlot * THREAD_LINE);
+    if (ThreadSlot == 0) THREAD_ADD(slot, value);
+    else *slot += value;
+}
+
+static void ThreadReductionAddReal(ThreadReduction* reduction, double value) {
+    double* slot = (double*)(reduction->values + ThreadSlot * THREAD_LINE + sizeof(long long));
+    if (ThreadSlot) {
+        *slot += value;
+        return;
+    }
+    double old, sum;
+    __atomic_load(slot, &old, __ATOMIC_RELAXED);
+    do {
+        sum = old + value;
+    } while (__atomic_compare_exchange(slot, &old, &sum, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) == 0);
+}
+
+static long long ThreadReductionTotal(ThreadReduction* reduction) {
+    long long total = 0;
+    for (int i = 0; i < reduction->slots; i++) total += *(long long*)(reduction->values + i * THREAD_LINE);
+    return total;
+}
+
+static double ThreadReductionTotalReal(ThreadReduction* reduction) {
+    double total = 0;
+    for (int i = 0; i < reduction->slots; i++) total += *(double*)(reduction->values + i * THREAD_LINE + sizeof(long long));
+    return total;
+}
+
+static void ThreadReductionClear(ThreadReduction* reduction) {
+    memset(reduction->values, 0, (size_t)reduction->slots * THREAD_LINE);
+}
+
+static void ThreadReductionFree(ThreadReduction* reduction) {
+    if (reduction == NULL) return;
+    free(reduction->values);
+    free(reduction);
+}
+
+// a Thread object runs its run function on a thread of its own
+typedef struct ThreadHandle {
+    pthread_t thread;
+    void (*entry)(void*);
+    void* object;
+} ThreadHandle;
+
+static void* ThreadEntry(void* argument) {
+    ThreadHandle* handle = (ThreadHandle*)argument;
+    handle->entry(handle->object);
+    return NULL;
+}
+
+static ThreadHandle* ThreadStart(void (*entry)(void*), void* object) {
+    ThreadHandle* handle = (ThreadHandle*)malloc(sizeof(ThreadHandle));
+    handle->entry = entry;
+    handle->object = object;
+    if (pthread_create(&handle->thread, NULL, ThreadEntry, handle) != 0) {
+        free(handle);
+        return NULL;
+    }
+    return handle;
+}
+
+static void ThreadJoin(ThreadHandle* handle) {
+    if (handle == NULL) return;
+    pthread_join(handle->thread, NULL);
+    free(handle);
+}
+
+#endif
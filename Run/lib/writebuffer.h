@@ -0,0 +1,226 @@
+#ifndef RUN_WRITEBUFFER_H
+#define RUN_WRITEBUFFER_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// user space buffer in front of a FILE behind FileWriter and Console.
+// Writes are copied in and go out in one vectored write when the buffer
+// is full, on flush, or per line when it is line buffered. A write that
+// doesn't fit is sent together with what is buffered, without copying it.
+// The bytes go straight to the descriptor, anything left in the buffer of
+// the FILE is flushed before them. Live buffers are written out at exit.
+// A FileWriter belongs to one thread, the Console buffer is shared and
+// every write to it takes the lock
+
+#ifdef _WIN32
+#include <io.h>
+#define WRITEBUFFER_FD(fp) _fileno(fp)
+#define WRITEBUFFER_TTY(fd) _isatty(fd)
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+static long WriteBufferWritev(int fd, struct iovec* parts, int count) {
+    long total = 0;
+    for (int i = 0; i < count; i++) {
+        int n = _write(fd, parts[i].iov_base, (unsigned)parts[i].iov_len);
+        if (n < 0) return total ? total : -1;
+        total += n;
+        if ((size_t)n < parts[i].iov_len) break;
+    }
+    return total;
+}
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#define WRITEBUFFER_FD(fp) fileno(fp)
+#define WRITEBUFFER_TTY(fd) isatty(fd)
+#define WriteBufferWritev(fd, parts, count) writev(fd, parts, count)
+#endif
+
+#if defined(__GNUC__) && !defined(__TINYC__) && !defined(_WIN32)
+#include <pthread.h>
+#define WRITEBUFFER_LOCKED
+static pthread_mutex_t WriteBufferMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+#define WRITEBUFFER_CAPACITY 8192
+// room a number needs: 20 digits, the sign and a newline
+#define WRITEBUFFER_NUMBER 22
+
+typedef struct WriteBuffer {
+    FILE* fp;
+    int fd;
+    int used;
+    int lines;
+    int failed;
+    int shared;
+    struct WriteBuffer* next;
+    struct WriteBuffer* prev;
+    char data[WRITEBUFFER_CAPACITY];
+} WriteBuffer;
+
+static void WriteBufferLock(void) {
+#if defined(WRITEBUFFER_LOCKED)
+    pthread_mutex_lock(&WriteBufferMutex);
+#endif
+}
+
+static void WriteBufferUnlock(void) {
+#if defined(WRITEBUFFER_LOCKED)
+    pthread_mutex_unlock(&WriteBufferMutex);
+#endif
+}
+
+static int WriteBufferOut(WriteBuffer* buffer, const void* value, int size, int newline);
+
+// buffers not closed yet, the ones of writers nobody closed still get
+// their bytes out when the program ends. That runs on the exiting thread
+// without the owners knowing: a FileWriter another thread still writes to
+// at exit has to be closed by that thread first, only the Console buffer
+// is safe to leave open
+static WriteBuffer* WriteBufferLive = NULL;
+static int WriteBufferRegistered = 0;
+
+static void WriteBufferExit(void) {
+    WriteBufferLock();
+    for (WriteBuffer* buffer = WriteBufferLive; buffer; buffer = buffer->next) {
+        if (buffer->used > 0) WriteBufferOut(buffer, NULL, 0, 0);
+    }
+    WriteBufferUnlock();
+}
+
+static WriteBuffer* WriteBufferNew(FILE* fp, int lines) {
+    if (fp == NULL) return NULL;
+    WriteBuffer* buffer = (WriteBuffer*)malloc(sizeof(WriteBuffer));
+    if (buffer == NULL) return NULL;
+    buffer->fp = fp;
+    buffer->fd = WRITEBUFFER_FD(fp);
+    buffer->used = 0;
+    buffer->lines = lines;
+    buffer->failed = 0;
+    buffer->shared = 0;
+    buffer->prev = NULL;
+    WriteBufferLock();
+    if (WriteBufferRegistered == 0) {
+        WriteBufferRegistered = 1;
+        atexit(WriteBufferExit);
+    }
+    buffer->next = WriteBufferLive;
+    if (buffer->next) buffer->next->prev = buffer;
+    WriteBufferLive = buffer;
+    WriteBufferUnlock();
+    return buffer;
+}
+
+// the buffered bytes, then size bytes of value and a newline if asked,
+// retrying short writes until all is out
+static int WriteBufferOut(WriteBuffer* buffer, const void* value, int size, int newline) {
+    struct iovec parts[3];
+    int count = 0;
+    if (buffer->used > 0) parts[count++] = (struct iovec){buffer->data, (size_t)buffer->used};
+    if (size > 0) parts[count++] = (struct iovec){(void*)value, (size_t)size};
+    if (newline) parts[count++] = (struct iovec){(void*)"\n", 1};
+    buffer->used = 0;
+    fflush(buffer->fp);
+    struct iovec* part = parts;
+    while (count > 0) {
+        long n = WriteBufferWritev(buffer->fd, part, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            buffer->failed = 1;
+            return 0;
+        }
+        for (; count > 0 && (size_t)n >= part->iov_len; part++, count--) n -= (long)part->iov_len;
+        if (count > 0) {
+            part->iov_base = (char*)part->iov_base + n;
+            part->iov_len -= (size_t)n;
+        }
+    }
+    return 1;
+}
+
+static int WriteBufferFlush(WriteBuffer* buffer) {
+    if (buffer == NULL) return 0;
+    if (buffer->shared) WriteBufferLock();
+    int done = buffer->used == 0 || WriteBufferOut(buffer, NULL, 0, 0);
+    if (buffer->shared) WriteBufferUnlock();
+    return done;
+}
+
+static void WriteBufferWrite(WriteBuffer* buffer, const void* value, int size, int newline) {
+    if (buffer == NULL) return;
+    if (size < 0) size = 0;
+    if (buffer->shared) WriteBufferLock();
+    if (buffer->used + size + newline > WRITEBUFFER_CAPACITY) {
+        WriteBufferOut(buffer, value, size, newline);
+    } else {
+        if (size > 0) memcpy(buffer->data + buffer->used, value, size);
+        buffer->used += size;
+        if (newline) {
+            buffer->data[buffer->used++] = '\n';
+            if (buffer->lines) WriteBufferOut(buffer, NULL, 0, 0);
+        }
+    }
+    if (buffer->shared) WriteBufferUnlock();
+}
+
+// digits straight into the buffer, no string in between
+static void WriteBufferNumber(WriteBuffer* buffer, long long value, int is_signed, int newline) {
+    if (buffer == NULL) return;
+    if (buffer->shared) WriteBufferLock();
+    if (buffer->used + WRITEBUFFER_NUMBER > WRITEBUFFER_CAPACITY) WriteBufferOut(buffer, NULL, 0, 0);
+    unsigned long long n = (unsigned long long)value;
+    if (is_signed && value < 0) {
+        buffer->data[buffer->used++] = '-';
+        n = 0ULL - n;
+    }
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    while (count) buffer->data[buffer->used++] = digits[--count];
+    if (newline) {
+        buffer->data[buffer->used++] = '\n';
+        if (buffer->lines) WriteBufferOut(buffer, NULL, 0, 0);
+    }
+    if (buffer->shared) WriteBufferUnlock();
+}
+
+static void WriteBufferClose(WriteBuffer* buffer) {
+    if (buffer == NULL) return;
+    WriteBufferLock();
+    if (buffer->used > 0) WriteBufferOut(buffer, NULL, 0, 0);
+    if (buffer->prev) buffer->prev->next = buffer->next;
+    else WriteBufferLive = buffer->next;
+    if (buffer->next) buffer->next->prev = buffer->prev;
+    WriteBufferUnlock();
+    free(buffer);
+}
+
+// standard output, line buffered on a terminal, made once by whichever
+// thread writes first
+static WriteBuffer* WriteBufferStdout = NULL;
+
+static void WriteBufferConsoleInit(void) {
+    WriteBuffer* buffer = WriteBufferNew(stdout, WRITEBUFFER_TTY(WRITEBUFFER_FD(stdout)));
+    if (buffer) buffer->shared = 1;
+    WriteBufferStdout = buffer;
+}
+
+static WriteBuffer* WriteBufferConsole(void) {
+#if defined(WRITEBUFFER_LOCKED)
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, WriteBufferConsoleInit);
+#else
+    if (WriteBufferStdout == NULL) WriteBufferConsoleInit();
+#endif
+    return WriteBufferStdout;
+}
+
+#endif
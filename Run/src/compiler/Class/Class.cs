@@ -1,4 +1,5 @@
 ﻿using System.Collections.Generic;
+using System.Text;
 
 namespace Run {
     public class Generic : AST {
@@ -66,14 +67,23 @@ namespace Run {
         public Function toString;
         public bool IsBased => BaseToken != null;
         public bool IsNumber;
+        public int Align;
         public Class Base;
         public AST BaseToken;
         public int BaseCount => Base != null ? Base.BaseCount + 1 : 0;
+        public List<Generic> Generics;
+        public string Header;
+        public string Template;
+        public bool HasGenerics => Generics != null && Generics.Count > 0;
 
         public override void Parse() {
             SetAccess();
             GetAnnotations();
             ParseNames();
+            if (HasGenerics) {
+                ParseTemplate();
+                return;
+            }
             if (Scanner.Expect('{') == false) {
                 Program.AddError(Scanner.Current, Error.ExpectingBeginOfBlock);
             }
@@ -99,6 +109,11 @@ namespace Run {
                     case "number":
                         IsNumber = true;
                         break;
+                    case "align":
+                        if (int.TryParse(Annotations[i].Value, out Align) == false || Align <= 0 || (Align & (Align - 1)) != 0) {
+                            Program.AddError(Annotations[i].Token, "Align Annotation expects a power of two");
+                        }
+                        break;
                 }
             }
         }
@@ -139,16 +154,87 @@ namespace Run {
             //        return;
             //    }
             //}
-            //if (Scanner.Expect('<')) {
-            //    Generics = ParseGenerics(this);
-            //    Real += "_" + string.Join("_", Generics.Select(g => g.Token.Value));
-            //}
+            if (Scanner.Expect('<')) {
+                ParseGenerics();
+                return;
+            }
             if (Scanner.Expect(':')) {
                 ParseBased();
                 ParseInterfaces();
             }
         }
 
+        private void ParseGenerics() {
+            Generics = new(1);
+            do {
+                var generic = new Generic();
+                generic.SetParent(this);
+                generic.Parse();
+                Generics.Add(generic);
+            } while (Scanner.Expect(','));
+            if (Scanner.Expect('>') == false) {
+                Program.AddError(Scanner.Current, Error.ExpectingEndOfGenerics);
+            }
+        }
+
+        // a generic type is kept as source and parsed again for every
+        // instance, see Program.Instantiate
+        private void ParseTemplate() {
+            Template = Scanner.TakeBlock(out Header);
+            (Parent as Block).Children.Remove(this);
+            if (Template == null) {
+                Program.AddError(Token, Error.ExpectingBeginOfBlock);
+                return;
+            }
+            if (Program.Templates.TryAdd(Token.Value, this) == false) {
+                Program.AddError(Token, Error.NameAlreadyExists);
+            }
+        }
+
+        public string Instantiate(string name, List<string> args) {
+            var types = new Dictionary<string, string>(Generics.Count);
+            for (int i = 0; i < Generics.Count; i++) {
+                types[Generics[i].Token.Value] = args[i];
+            }
+            var source = new StringBuilder();
+            foreach (var annotation in Annotations) {
+                source.Append('@').Append(annotation.Token.Value);
+                if (annotation.Value != null) source.Append('(').Append(annotation.Value).Append(')');
+                source.Append('\n');
+            }
+            source.Append("type ").Append(name);
+            Substitute(source, Header, types);
+            source.Append('{');
+            Substitute(source, Template, types);
+            source.Append('}');
+            return source.ToString();
+        }
+
+        // replaces whole names outside strings, comments and member accesses
+        static void Substitute(StringBuilder source, string code, Dictionary<string, string> types) {
+            for (int i = 0; i < code.Length;) {
+                var c = code[i];
+                int start = i;
+                if (c == '"' || c == '\'') {
+                    i++;
+                    while (i < code.Length && code[i] != c) i += code[i] == '\\' ? 2 : 1;
+                    i = System.Math.Min(i + 1, code.Length);
+                } else if (c == '/' && i + 1 < code.Length && code[i + 1] == '/') {
+                    while (i < code.Length && code[i] != '\n') i++;
+                } else if (char.IsLetter(c) || c == '_') {
+                    while (i < code.Length && (char.IsLetterOrDigit(code[i]) || code[i] == '_')) i++;
+                    var word = code[start..i];
+                    if ((start == 0 || code[start - 1] != '.') && types.TryGetValue(word, out var type)) {
+                        source.Append(type);
+                        continue;
+                    }
+                } else {
+                    i++;
+                }
+                source.Append(code, start, i - start);
+            }
+        }
+
         private void ParseInterfaces() {
             while (Scanner.Expect(",")) {
                 Interfaces ??= new(0);
@@ -168,10 +254,7 @@ namespace Run {
         private void ParseBased() {
             BaseToken = new AST();
             BaseToken.SetParent(this);
-            if (GetName(out BaseToken.Token) == false) return;
-            //if (Scanner.Expect('<')) {
-            //    Based.Generics = ParseGenerics(Based);
-            //}
+            if (GetTypeName(out BaseToken.Token) == false) return;
         }
 
         public override AST Find(string token) {
@@ -184,10 +267,10 @@ namespace Run {
             if (Annotations != null)
                 foreach (var annotation in Annotations)
                     annotation.Print();
-            //if (Generics != null) {
-            //    foreach (var generic in Generics)
-            //        generic.Print();
-            //}
+            if (Generics != null) {
+                foreach (var generic in Generics)
+                    generic.Print();
+            }
             AST.Print(Base);
             foreach (var child in Children) {
                 child.Print();
@@ -10,6 +10,7 @@ namespace Run {
                 Program.AddError(Scanner.Current, Error.InvalidExpression);
                 return;
             }
+            GetAnnotations();
             if (GetIndex() == false) return;
             if (CheckOthersIndexes(cls) == false) return;
             if (GetReturnType() == false) return;
@@ -69,7 +70,7 @@ namespace Run {
                 Program.AddError(Scanner.Current, Error.ExpectingDeclare);
                 return false;
             }
-            if (GetName(out Token type) == false) return false;
+            if (GetTypeName(out Token type) == false) return false;
             Index.Type = new Class() {
                 Token = type,
                 IsTemporary = true,
@@ -87,7 +88,7 @@ namespace Run {
                 Program.AddError(Scanner.Current, Error.ExpectingDeclare);
                 return false;
             }
-            if (GetName(out Token type) == false) return false;
+            if (GetTypeName(out Token type) == false) return false;
             Type = new Class() {
                 Token = type,
                 IsTemporary = true,
@@ -11,12 +11,13 @@ namespace Run {
 
     public class Property : GetterSetter {
         public override void Parse() {
+            GetAnnotations();
             if (GetName(out Token) == false) return;
             if (Scanner.Expect(':') == false) {
                 Program.AddError(Scanner.Current, Error.ExpectingDeclare);
                 return;
             }
-            if (GetName(out Token type) == false) return;
+            if (GetTypeName(out Token type) == false) return;
             Type = new Class {
                 Token = type,
                 IsTemporary = true,
@@ -101,6 +101,31 @@ namespace Run {
             return true;
         }
 
+        public bool GetTypeName(out Token token) {
+            if (GetName(out token) == false) return false;
+            return GetGenerics(token);
+        }
+
+        // name<A, B> in a type position becomes the name of its instance
+        public bool GetGenerics(Token token) {
+            if (Scanner.Expect('<') == false) return true;
+            var args = new List<string>(1);
+            do {
+                if (GetTypeName(out Token arg) == false) return false;
+                args.Add(arg.Value);
+            } while (Program.closingGenerics == 0 && Scanner.Expect(','));
+            if (Program.closingGenerics > 0) {
+                Program.closingGenerics--;
+            } else if (Scanner.Expect('>')) {
+                if (Scanner.Current.Value == ">>") Program.closingGenerics++;
+            } else {
+                Program.AddError(Scanner.Current, Error.ExpectingEndOfGenerics);
+                return false;
+            }
+            token.Value = Program.Instantiate(token, args);
+            return true;
+        }
+
         public virtual void GetAnnotations() {
             Annotations = new(0);
 
@@ -5,6 +5,8 @@
         public string Path;
         public static readonly string InterfaceOnlyAcceptsPropertiesAndFunctions = "Interface only accepts properties and functions";
         public static readonly string ExpectedPublicAcces = "Expected Public Access";
+        public static readonly string CompilerNotFound = "No C compiler found, install gcc, clang or tcc or set CC";
+        public static readonly string CompilationFailed = "C compilation failed";
         public static readonly string ExpectedStaticAcess = "Expected Static Access";
         public static readonly string ExpectingArrowOfBeginOfBlock = "Expecting '=>' or '{'";
         public static readonly string ExpectingOpenParenteses = "Expecting (";
@@ -56,6 +58,10 @@
         public static readonly string OnlyInFunctionOrModuleScope = "Only Allowed inside of Function or Module Scope";
         public static readonly string OnlyInModuleScope = "Only Allowed inside of Module Scope";
         public static readonly string OnlyInFunctionScope = "Only Allowed Inside of Function Scope";
+        public static readonly string ExpectingParallelRange = "Expecting a range, parallel for runs over ..n";
+        public static readonly string ExpectingParallelI32 = "Parallel for bounds have to be i32";
+        public static readonly string InvalidAtomic = "Atomic only works with numbers, bool and references";
+        public static readonly string NotAllowedInParallelFor = "Not allowed inside a parallel for";
         public static readonly string OnlyInFunctionBlock = "Only Allowed Inside of Block";
         public static readonly string NativeClassNotAllowed = "Member not allowed in native class";
         public static readonly string ScopeOnlyOfConstructorNoParameters = "Scope only accepts constructor with no parameters";
@@ -65,6 +71,8 @@
         public static readonly string InterfaceMemberNotFound = "Interface member not found";
         public static readonly string InterfaceCannotBeBased = "Interface cannot have base class or interface";
         public static readonly string GenericNameAlreadyClassDefined = "Generic name already class defined";
+        public static readonly string ExpectingEndOfGenerics = "Expecting >";
+        public static readonly string WrongNumberOfGenerics = "Wrong number of generic arguments";
         public static readonly string InterfaceMemberHasDifferentReturnType = "Interface member has different return type";
         public static readonly string InterfaceMemberHasDifferentParameters = "Interface member has different parameters";
         public static readonly string InterfaceNotImplementedCorrect = "Interface not implemented correct";
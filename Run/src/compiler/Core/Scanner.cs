@@ -241,6 +241,41 @@ namespace Run {
             return token;
         }
 
+        // raw text up to the next '{' and the body of the block it opens,
+        // skipped without tokens so generic types can be parsed per instance
+        internal string TakeBlock(out string header) {
+            header = null;
+            Setup();
+            var start = Position < 0 ? 0 : Position;
+            var open = Data.IndexOf('{', start);
+            if (open < 0) return null;
+            int block = 1, end = open + 1;
+            while (end < Data.Length && block > 0) {
+                switch (Data[end]) {
+                    case '{': block++; break;
+                    case '}': block--; break;
+                    case '"':
+                    case '\'':
+                        var quote = Data[end++];
+                        while (end < Data.Length && Data[end] != quote) end += Data[end] == '\\' ? 2 : 1;
+                        break;
+                    case '/':
+                        if (end + 1 < Data.Length && Data[end + 1] == '/') {
+                            while (end < Data.Length && Data[end] != '\n') end++;
+                            continue;
+                        }
+                        break;
+                }
+                end++;
+            }
+            if (block > 0) return null;
+            header = Data[start..open];
+            Line += Data.AsSpan(start, end - start).Count('\n');
+            Position = end;
+            Column = 0;
+            return Data[(open + 1)..(end - 1)];
+        }
+
         public Token Get(string value) {
             var scan = Scan();
             if (scan == null) {
@@ -675,9 +710,10 @@ namespace Run {
                 case '&':
                     len = 1;
                     tok.Type = TokenType.BITWISE_AND;
-                    tok.Family = TokenType.LOGICAL;
+                    tok.Family = TokenType.ARITMETIC;
                     if (Valid && Data[Position + 1] == '&') {
                         tok.Type = TokenType.AND;
+                        tok.Family = TokenType.LOGICAL;
                         Position++;
                         len = 2;
                     } else if (Valid && Data[Position + 1] == '=') {
@@ -690,9 +726,10 @@ namespace Run {
                 case '|':
                     len = 1;
                     tok.Type = TokenType.BITWISE_OR;
-                    tok.Family = TokenType.LOGICAL;
+                    tok.Family = TokenType.ARITMETIC;
                     if (Valid && Data[Position + 1] == '|') {
                         tok.Type = TokenType.OR;
+                        tok.Family = TokenType.LOGICAL;
                         Position++;
                         len = 2;
                     } else if (Valid && Data[Position + 1] == '=') {
@@ -704,7 +741,7 @@ namespace Run {
                     break;
                 case '^':
                     tok.Type = TokenType.XOR;
-                    tok.Family = TokenType.LOGICAL;
+                    tok.Family = TokenType.ARITMETIC;
                     tok.Value = Data.Substring(start, 1);
                     break;
                 case '"':
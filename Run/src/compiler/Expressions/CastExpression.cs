@@ -10,6 +10,13 @@ namespace Run {
                 return;
             }
             Scanner.Scan();
+            // only a known template, so 'x as i32 < y' still compares
+            var type = Scanner.Current;
+            if (Program.Templates.ContainsKey(type.Value) && GetGenerics(type) == false) {
+                Scanner.SkipLine();
+                return;
+            }
+            Scanner.Current = type;
             Right = new TypeExpression(this);
             if (Scanner.Expect('[')) {
                 if (Scanner.Expect(']') == false) {
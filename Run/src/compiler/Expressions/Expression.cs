@@ -30,10 +30,13 @@ namespace Run {
                 case TokenType.GREAT_OR_EQUAL: return (int)PrecedenceLevel.Comparison;
                 case TokenType.PLUS:
                 case TokenType.DIFFERENT:
+                case TokenType.BITWISE_OR:
+                case TokenType.XOR:
                 case TokenType.MINUS: return (int)PrecedenceLevel.Term;
                 case TokenType.TERNARY: return (int)PrecedenceLevel.Ternary;
                 case TokenType.MULTIPLY:
                 case TokenType.MOD:
+                case TokenType.BITWISE_AND:
                 case TokenType.DIVIDE: return (int)PrecedenceLevel.Factor;
                 case TokenType.INCREMENT:
                 case TokenType.DECREMENT:
@@ -60,6 +63,8 @@ namespace Run {
     public class Expression : ValueType {
 
         public bool HasError { get; private set; }
+        // proven not null, safe mode doesn't check it
+        public bool NotNull;
 
         public override void Print() {
             ExpressionHelper.Print(this);
@@ -125,6 +125,9 @@ namespace Run {
                 case TokenType.MINUS:
                 case TokenType.MULTIPLY:
                 case TokenType.DIVIDE:
+                case TokenType.BITWISE_AND:
+                case TokenType.BITWISE_OR:
+                case TokenType.XOR:
                 case TokenType.OR:
                 case TokenType.AND:
                 case TokenType.EQUAL:
@@ -5,6 +5,8 @@ namespace Run {
     internal class NewExpression : ContentExpression {
         public string QualifiedName;
         public bool IsScoped;
+        // made by the validator for an @implicit conversion, not written with new
+        public bool IsImplicit;
         public NewExpression(AST parent, bool parse = true) {
             SetParent(parent);
             if (parse) Parse();
@@ -27,6 +29,11 @@ namespace Run {
                 break;
             }
             Token.Value = QualifiedName;
+            if (GetGenerics(Token) == false) {
+                Scanner.SkipLine();
+                return;
+            }
+            QualifiedName = Token.Value;
             if (Scanner.Expect('(')) {
                 Content = new ConstructorExpression(this) {
                     Token = Token,
@@ -251,7 +251,7 @@ namespace Run {
             }
         }
         public void GetReturnType() {
-            if (GetName(out Token type) == false) return;
+            if (GetTypeName(out Token type) == false) return;
             Type = new Class() {
                 Token = type,
             };
@@ -37,6 +37,27 @@ namespace Run {
             defer.Parse();
         }
 
+        // parallel for, 'parallel' is still a name anywhere else
+        internal static bool ParseParallel(Block parent) {
+            var scanner = parent.Scanner;
+            var (position, column) = (scanner.Index, scanner.Column);
+            if (scanner.Expect("for") == false) {
+                // Expect skips the blanks, the caller rolls back from where the name ended
+                scanner.Set(position);
+                scanner.Column = column;
+                return false;
+            }
+            if (parent.FindParent<Function>() == null) {
+                parent.Program.AddError(parent.Scanner.Current, Error.OnlyInFunctionBlock);
+                parent.Scanner.SkipLine();
+                return true;
+            }
+            var loop = parent.Add<For>();
+            loop.IsParallel = true;
+            loop.Parse();
+            return true;
+        }
+
         internal static void ParseConst(Block parent) {
             if (parent is Function || parent is Module) {
                 var v = parent.Add<Var>();
@@ -99,6 +120,7 @@ namespace Run {
                 case "label": CheckAndParse<Label>(parent, () => parent.FindParent<Function>() != null); break;
                 case "using": CheckAndParse<Using>(parent, () => parent is Module); break;
                 case "delete": CheckAndParse<Delete>(parent, () => parent.FindParent<Function>() != null); break;
+                case "scope": CheckAndParse<Scope>(parent, () => parent.FindParent<Function>() != null); break;
                 case "return": CheckAndParse<Return>(parent, () => parent.FindParent<Function>() != null); break;
                 case "static": AST.CurrentAccess = AccessType.STATIC; break;
                 case "switch": CheckAndParse<Switch>(parent, () => parent.FindParent<Function>() != null); break;
@@ -111,6 +133,7 @@ namespace Run {
                 case "extension": CheckAndParse<Extension>(parent, () => parent is Module); break;
                 case "interface": CheckAndParse<Interface>(parent, () => parent is Module); break;
                 case "namespace": CheckAndParse<Namespace>(parent, () => parent.Scanner.Line == 1); break;
+                case "parallel": return ParseParallel(parent);
                 default: return false;
             }
             return true;
@@ -7,6 +7,8 @@ namespace Run {
         internal Expression Step;
         internal int Stage = -1;
         internal bool HasRange;
+        // each iteration can run on another thread of the pool
+        internal bool IsParallel;
 
         public override void Parse() {
         again:
@@ -1,15 +1,16 @@
 ﻿namespace Run {
-    public class Scope : ValueType {
-        public Scope(AST parent) {
-            Parent = parent;
-        }
+    public class Scope : Block {
+        static internal int Counter = 0;
+        internal int ID;
 
         public override void Parse() {
-            if (GetName(out Token) == false) return;
-            if (Scanner.IsEOL() == false) {
-                Program.AddError(Scanner.Current, Error.ExpectingEndOfLine);
-                Scanner.SkipLine();
+            Token = Scanner.Current;
+            ID = Counter++;
+            if (Scanner.Expect('{') == false) {
+                Program.AddError(Scanner.Current, Error.ExpectingBeginOfBlock);
+                return;
             }
+            base.Parse();
         }
     }
 }
\ No newline at end of file
@@ -9,7 +9,8 @@ namespace Run {
         public Expression Initializer;
         public int Usage = 0;
         public bool IsConst;
-        public bool NeedRegister = false;
+        // @atomic, declared as a C11 atomic
+        public bool IsAtomic => Annotations?.Exists(a => a.Token.Value == "atomic") ?? false;
 
         public void Parse(bool full) {
             if (full) {
@@ -57,7 +58,7 @@ namespace Run {
         }
 
         public virtual bool GetReturnType() {
-            if (GetName(out Token type) == false) return false;
+            if (GetTypeName(out Token type) == false) return false;
             Type = new Class() {
                 Token = type,
                 IsTemporary = true,
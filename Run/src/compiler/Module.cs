@@ -97,6 +97,12 @@ namespace Run {
             Module = this;
         }
 
+        public Module(string name, string source) : this(new MemoryStream(System.Text.Encoding.UTF8.GetBytes(source))) {
+            Path = name;
+            Token.Value = name;
+            Scanner.Path = name;
+        }
+
         public Module(Stream stream) {
             Path = "stream.run";
             Token = new Token {
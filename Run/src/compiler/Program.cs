@@ -22,7 +22,17 @@ namespace Run {
         public HashSet<string> Libraries = [];
         public Dictionary<string, AST> Implicits = [];
         public Dictionary<string, Module> Usings = [];
+        public Dictionary<string, Class> Templates = [];
+        readonly Dictionary<string, (Token Token, string Template, List<string> Arguments)> instances = [];
+        readonly Queue<string> pending = [];
+        // '>>' closes two generic lists at once, the outer one must not expect it again
+        internal int closingGenerics;
         public bool HasMain;
+        public bool ProfileAllocations;
+        public bool SafeMode;
+        public BuildProfile BuildProfile;
+        // arguments of the training run of a pgo build
+        public string Training;
         public Main Main;
         internal string ExecutionFolder;
         public Program(string path) : base(path) {
@@ -47,6 +57,34 @@ namespace Run {
             Print("Parsing ...", base.Parse);
         }
 
+        // array<i32> is named array_i32 and parsed once the builtin templates are loaded
+        internal string Instantiate(Token template, List<string> args) {
+            var name = template.Value + "_" + string.Join("_", args);
+            if (instances.TryAdd(name, (template, template.Value, args))) {
+                pending.Enqueue(name);
+            }
+            return name;
+        }
+
+        internal void ParseInstances() {
+            while (pending.TryDequeue(out var name)) {
+                var (token, generic, args) = instances[name];
+                if (Templates.TryGetValue(generic, out var template) == false) {
+                    AddError(token, Error.UnknownType);
+                    continue;
+                }
+                if (template.Generics.Count != args.Count) {
+                    AddError(token, Error.WrongNumberOfGenerics);
+                    continue;
+                }
+                var instance = new Module(name, template.Instantiate(name, args)) {
+                    Program = this,
+                };
+                instance.Parse();
+                Children.Insert(0, instance);
+            }
+        }
+
         public bool PrintErrors() {
             HasErrors |= Errors.Count > 0;
             if (HasErrors) {
@@ -3,9 +3,13 @@ using System.Collections.Generic;
 using System.Diagnostics;
 using System.IO;
 using System.Linq;
+using System.Numerics;
+using System.Text;
 
 namespace Run {
     public class C_Transpiler : Transpiler {
+        readonly List<Token> profileSites = [];
+
         public C_Transpiler(Builder builder) : base(builder) { }
 
         public override void Save(string path) {
@@ -36,25 +40,60 @@ namespace Run {
                 #include "../lib/arena.h"
 
                 """);
+            if (Builder.Program.ProfileAllocations) {
+                Writer.WriteLine("#include \"../lib/profile.h\"\n");
+            }
+            if (HasParallel()) {
+                Writer.WriteLine("#include \"../lib/thread.h\"\n");
+            }
             SaveAnnotations();
             SaveDefines();
 
             SaveDeclarations();
             SaveReflectionDeclarations();
+            SaveVirtualTables();
+            SaveThreadEntry();
+            if (Builder.Program.SafeMode) {
+                SaveChecks();
+            }
             SaveAllocator();
+            SaveStringConcat();
+            FindLiteralFields();
+            // the literals are known once the code using them is written
+            var code = Writer;
+            Writer = new StringWriter();
             SaveImplementations();
             SaveInitializer();
+            var implementations = Writer.ToString();
+            Writer = code;
+            SaveLiterals();
+            foreach (var task in parallelTasks) {
+                Writer.Write(task);
+            }
+            Writer.Write(implementations);
             Writer.Close();
         }
 
         private void SaveDefines() {
             Writer.WriteLine("""
-                void resizeMap();
-                void* Alloc(int size, int id);
-                bool IS(int address, int is);
-
-                #define SCOPE(T,id)  ArenaScope(sizeof(T),id))
-                #define DELETE(V) ArenaFree(V); V = 0
+                static inline bool IS(void* ptr, int is);
+
+                #define SCOPE(T,id) ((T*)ArenaScope(&(struct { int64_t header[2]; T value; }){0}.value, sizeof(T), id))
+                #if defined(__GNUC__) && !defined(__TINYC__)
+                #define INLINE static inline __attribute__((always_inline))
+                #else
+                #define INLINE static inline
+                #endif
+                """);
+            if (Builder.Program.ProfileAllocations) {
+                Writer.WriteLine("""
+                    #define DELETE(V) ProfileFree(V); ArenaFree(V); V = 0
+                    #define PROFILE_NEW(site,T,total,id,region) (T*)ProfileNew(sizeof(T)*(total),_Alignof(T),region,id,site)
+                    """);
+            } else {
+                Writer.WriteLine("#define DELETE(V) ArenaFree(V); V = 0");
+            }
+            Writer.WriteLine("""
                 #define CAST(T,exp) (*(T*)exp)
                 #define SIZEOF(V) (int)((char *)(&V+1)-(char*)(&V))
                 #define CONVERT(T,ptr) *((T*)ptr)
@@ -68,17 +107,8 @@ namespace Run {
                 #define ENDTRY } } while (0)
                 #define THROW(j,x) longjmp(j, x)
 
-                #define NEW(T,total,id, region) (T*)ArenaAlloc(sizeof(T)*total,region, id)
+                #define NEW(T,total,id, region) (T*)ArenaAllocAligned(sizeof(T)*(total), _Alignof(T), region, id)
 
-                int* mapAlloc;
-                int mapSize = 0;
-                int mapCapacity = 32 * 1024;
-
-                #define REGISTER(var, id)   \
-                  resizeMap();                       \
-                  mapAlloc[mapSize++] = (long)(var); \
-                  mapAlloc[mapSize++] = id
-                
                 typedef struct ReflectionArgument ReflectionArgument;
                 typedef struct ReflectionMember ReflectionMember;
                 typedef struct ReflectionType ReflectionType;
@@ -87,37 +117,10 @@ namespace Run {
 
         private void SaveAllocator() {
             Writer.WriteLine("""
-                void resizeMap() {
-                    if(mapSize == 0) {
-                        mapAlloc = (int*)malloc(mapCapacity * sizeof(int));
-                    } else if (mapSize >= mapCapacity) {
-                        mapCapacity *= 1.5;
-                        mapAlloc = (int*)realloc(mapAlloc, mapCapacity * sizeof(int));
-                    }
-                }
-
-                void* Alloc(int size, int id) {
-                  void* mem = malloc(size);
-                  resizeMap();
-                  REGISTER(mem, id);
-                  return mem;
-                }
-
-                bool IS(int address, int is) {
-                  for (int i = 0; i < mapSize; i++) {
-                    if (mapAlloc[i] == address) {
-                      int id = mapAlloc[i + 1];
-                      if (id == is) return true;
-                    again:
-                      if (id<0 || id> __TypesCount__) return false;
-                      ReflectionType* tp = __TypesMap__[id];
-                      if (!tp) return false;
-                      if (tp->id == is) return true;
-                      id = tp->based;
-                      goto again;
-                    }
-                  }
-                  return false;
+                static inline bool IS(void* ptr, int is) {
+                  int id = ArenaTypeOf(ptr);
+                  if (id < 0 || id >= __TypesCount__ || is < 0 || is >= __TypesCount__) return false;
+                  return __TypesLow__[is] <= __TypesLow__[id] && __TypesLow__[id] <= __TypesHigh__[is];
                 }
                 """);
         }
@@ -131,27 +134,28 @@ namespace Run {
                 Console.WriteLine("\n.....Empty");
                 return true;
             }
-            var libraries = Builder.Program.FindChildren<Library>().Select(l => l.Token.Value).Distinct().ToList();
+            var libraries = Builder.Program.FindChildren<Library>().Select(l => l.Token.Value.Trim('"')).Distinct().ToList();
+            if (HasParallel() && libraries.Contains("pthread") == false) {
+                libraries.Add("pthread");
+            }
             var location = AppContext.BaseDirectory;
-            var tcc = Directory.EnumerateFiles(location, "tcc.exe", SearchOption.AllDirectories).FirstOrDefault();
-            var info = new ProcessStartInfo(tcc) {
-                Arguments = "-I" + Path.GetDirectoryName(location) + "/lib " + (Builder.Program.HasMain ? "-o " : "-c ") + "..\\" + Builder.Program.Token.Value + ".exe " + Destination + " -w " + (libraries.Count > 0 ? " -L" + string.Join(" -L", libraries.Select(Path.GetDirectoryName)) + "\"" + " -l\"" + string.Join(" -l\"", libraries.Select(Path.GetFileName)) : ""),
-                WindowStyle = ProcessWindowStyle.Hidden,
-            };
-            //var info = new ProcessStartInfo("gcc") {
-            //    Arguments = "-o " + Builder.Program.Token.Value + ".exe " + Destination + " -std=c99 -w -O2 -fpermissive",
-            //    WindowStyle = ProcessWindowStyle.Hidden,
-            //};
-            var proc = Process.Start(info);
-            proc.WaitForExit();
-            if (proc.ExitCode != 0) {
+            var toolchain = Toolchain.Find(Builder.Program.BuildProfile, HasThreads());
+            if (toolchain == null) {
+                Builder.Program.AddError(Error.CompilerNotFound);
+                return false;
+            }
+            var output = Path.Combine("..", Builder.Program.Token.Value + (OperatingSystem.IsWindows() ? ".exe" : ""));
+            // the generated code includes ../lib/arena.h, the compiler runs from lib
+            string[] includes = [Path.GetDirectoryName(location) + "/lib", Environment.CurrentDirectory];
+            if (toolchain.Build(Destination, output, includes, libraries, Builder.Program.Training) == false) {
+                Builder.Program.AddError(Error.CompilationFailed);
                 return false;
             }
             return true;
         }
 
         void SaveReflectionStructs() {
-            Writer.WriteLine("""
+            var code = """
                 typedef struct ReflectionArgument {
                     const char* name;
                     int id;
@@ -160,6 +164,7 @@ namespace Run {
 
                 typedef struct ReflectionMember {
                     const char* name;
+                    unsigned hash;
                     int offset;
                     int kind;
                     int id;
@@ -169,28 +174,75 @@ namespace Run {
                     ReflectionArgument* args;
                 } ReflectionMember;
 
+                // a perfect hash built by the transpiler: the bucket of a hash
+                // gives the seed that moves it to a slot of its own
+                typedef struct ReflectionIndex {
+                    int buckets;
+                    int shift;
+                    const unsigned short* displace;
+                    const unsigned short* slots;
+                } ReflectionIndex;
+
                 typedef struct ReflectionType {
                     const char* name;
+                    unsigned hash;
                     int id;
                     int based;
                     int count;
                     ReflectionMember* children;
+                    ReflectionIndex index;
                 } ReflectionType;
 
-                static ReflectionMember* ReflectionType_getMember_string(ReflectionType* this, char* name) {
-                    for (int i = 0; i < this->count; i++) {
-                        if (strcmp(this->children[i].name, name) == 0) {
-                            return &this->children[i];
-                        }
+                // names come in as strings, which need not end with a zero
+                static inline unsigned ReflectionHash(const char* name, int size) {
+                    unsigned hash = 2166136261u;
+                    for (int i = 0; i < size; i++) hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+                    return hash;
+                }
+
+                static inline int ReflectionSize(STRING* name) {
+                    return name->SIZE < 0 ? (int)strlen(name->VALUE) : name->SIZE;
+                }
+
+                static inline int ReflectionSame(const char* known, const char* name, int size) {
+                    return strncmp(known, name, size) == 0 && known[size] == 0;
+                }
+
+                // the only entry a hash can be at, -1 when there is none
+                static inline int ReflectionSlot(const ReflectionIndex* index, unsigned hash) {
+                    if (index->slots == NULL) return -1;
+                    unsigned seed = index->displace[hash & (index->buckets - 1)];
+                    return (int)index->slots[((hash ^ seed) * 2654435769u) >> index->shift] - 1;
+                }
+
+                // the first member with the name. Different names with the same
+                // hash share a slot, the others are looked for in order
+                static int ReflectionFind(ReflectionType* this, const char* name, int size, unsigned hash) {
+                    int i = ReflectionSlot(&this->index, hash);
+                    if (i < 0 || this->children[i].hash != hash) return -1;
+                    if (ReflectionSame(this->children[i].name, name, size)) return i;
+                    for (i = 0; i < this->count; i++) {
+                        if (this->children[i].hash == hash && ReflectionSame(this->children[i].name, name, size)) return i;
                     }
-                    return NULL;
+                    return -1;
+                }
+
+                static ReflectionMember* ReflectionType_getMember_string(ReflectionType* this, STRING* name, Region* __region__) {
+                    if (name == NULL) return NULL;
+                    int size = ReflectionSize(name);
+                    int i = ReflectionFind(this, name->VALUE, size, ReflectionHash(name->VALUE, size));
+                    return i < 0 ? NULL : &this->children[i];
                 }
 
-                static void* ReflectionType_getFunction_string(ReflectionType* this, char* name) {
-                    for (int i = 0; i < this->count; i++) {
-                        ReflectionMember member = this->children[i];
-                        if (member.function!=NULL && strcmp(member.name, name) == 0) {
-                            return member.function;
+                // overloads and a field of the same name come after the first
+                static void* ReflectionType_getFunction_string(ReflectionType* this, STRING* name, Region* __region__) {
+                    if (name == NULL) return NULL;
+                    int size = ReflectionSize(name);
+                    unsigned hash = ReflectionHash(name->VALUE, size);
+                    for (int i = ReflectionFind(this, name->VALUE, size, hash); i >= 0 && i < this->count; i++) {
+                        ReflectionMember* member = &this->children[i];
+                        if (member->function != NULL && member->hash == hash && ReflectionSame(member->name, name->VALUE, size)) {
+                            return member->function;
                         }
                     }
                     return NULL;
@@ -202,7 +254,19 @@ namespace Run {
                 #define REFLETION_PROPERTY 4
                 #define REFLETION_INDEXER 5
 
-                """);
+                """;
+            Writer.WriteLine(ReflectionNames(code));
+        }
+
+        // the lookups take a string, its struct and fields are named the
+        // way the string type declares them
+        string ReflectionNames(string code) {
+            var cls = Builder.Classes["string"];
+            var fields = cls.Children.OfType<Field>().ToList();
+            return code
+                .Replace("STRING", cls.Real)
+                .Replace("SIZE", fields.First(f => f.Token.Value == "_size").Real)
+                .Replace("VALUE", fields.First(f => f.Token.Value == "value").Real);
         }
         private void SaveReflectionDeclarations() {
             SaveReflectionStructs();
@@ -221,38 +285,160 @@ namespace Run {
                 Writer.WriteLine(", ");
             }
             Writer.WriteLine("\t0\n};\n\n");
-
-            Writer.WriteLine("""
-                static ReflectionType* getType_string(char* name) {
-                    for (int i = 0; i < 
-                """ + (Class.CounterID + 1) + """
-                ; i++) {
-                        ReflectionType* tp = __TypesMap__[i];
-                        if (strcmp(tp->name, name) == 0) {
-                            return tp;
-                        }
+            SaveTypesRanges();
+            var types = Builder.Classes.Values.OrderBy(c => c.ID).ToList();
+            var index = SaveReflectionIndex("__Types", types.Select(c => ReflectionHash(c.Token.Value)).ToList());
+            Writer.Write("static const ReflectionIndex __TypesIndex__ = ");
+            Writer.Write(index);
+            Writer.WriteLine(";\n");
+            Writer.WriteLine(ReflectionNames("""
+                static ReflectionType* getType_string(STRING* name) {
+                    if (name == NULL) return NULL;
+                    int size = ReflectionSize(name);
+                    unsigned hash = ReflectionHash(name->VALUE, size);
+                    int i = ReflectionSlot(&__TypesIndex__, hash);
+                    if (i < 0 || __TypesMap__[i]->hash != hash) return NULL;
+                    if (ReflectionSame(__TypesMap__[i]->name, name->VALUE, size)) return (ReflectionType*)__TypesMap__[i];
+                """ + "    for (i = 0; i < " + types.Count + "; i++) {" + """
+
+                        if (__TypesMap__[i]->hash == hash && ReflectionSame(__TypesMap__[i]->name, name->VALUE, size)) return (ReflectionType*)__TypesMap__[i];
                     }
                     return NULL;
                 }
-                """);
+                """));
+        }
+
+        // FNV-1a, ReflectionHash in the generated code
+        static uint ReflectionHash(string name) {
+            uint hash = 2166136261;
+            foreach (var b in Encoding.UTF8.GetBytes(name)) {
+                hash = unchecked((hash ^ b) * 16777619);
+            }
+            return hash;
+        }
+
+        static int ReflectionSlot(uint hash, uint seed, int shift) => (int)(unchecked((hash ^ seed) * 2654435769) >> shift);
+
+        // writes the name_displace and name_slots tables and returns the
+        // ReflectionIndex that finds them. Hash and displace: the entries are
+        // spread over buckets by their low bits, then every bucket, the fullest
+        // first, takes the first seed that moves all its entries to free
+        // slots. The table doubles when a bucket runs out of seeds
+        string SaveReflectionIndex(string name, List<uint> hashes) {
+            var entries = new List<int>();
+            var seen = new HashSet<uint>();
+            for (int i = 0; i < hashes.Count; i++) {
+                if (seen.Add(hashes[i])) entries.Add(i);
+            }
+            if (entries.Count == 0) {
+                return "{1, 31, NULL, NULL}";
+            }
+            var buckets = (int)BitOperations.RoundUpToPowerOf2((uint)Math.Max(1, entries.Count / 2));
+            var groups = entries.GroupBy(i => hashes[i] & (uint)(buckets - 1)).OrderByDescending(g => g.Count()).ToList();
+            for (var bits = BitOperations.Log2(BitOperations.RoundUpToPowerOf2((uint)entries.Count * 2)); ; bits++) {
+                var displace = new int[buckets];
+                var slots = new int[1 << bits];
+                if (groups.All(group => Displace(group, hashes, slots, 32 - bits, out displace[group.Key]))) {
+                    SaveReflectionTable(name + "_displace", displace);
+                    SaveReflectionTable(name + "_slots", slots);
+                    return "{" + buckets + ", " + (32 - bits) + ", " + name + "_displace, " + name + "_slots}";
+                }
+            }
+        }
+
+        static bool Displace(IGrouping<uint, int> group, List<uint> hashes, int[] slots, int shift, out int seed) {
+            var taken = new List<int>();
+            for (seed = 0; seed <= ushort.MaxValue; seed++) {
+                taken.Clear();
+                foreach (var i in group) {
+                    var slot = ReflectionSlot(hashes[i], (uint)seed, shift);
+                    if (slots[slot] != 0 || taken.Contains(slot)) break;
+                    taken.Add(slot);
+                }
+                if (taken.Count < group.Count()) continue;
+                var k = 0;
+                foreach (var i in group) {
+                    slots[taken[k++]] = i + 1;
+                }
+                return true;
+            }
+            return false;
+        }
+
+        void SaveReflectionTable(string name, int[] values) {
+            Writer.Write("static const unsigned short ");
+            Writer.Write(name);
+            Writer.Write("[");
+            Writer.Write(values.Length);
+            Writer.Write("] = {");
+            Writer.Write(string.Join(", ", values));
+            Writer.WriteLine("};");
         }
+
+        // numbers the classes depth first along their base chains, so a type
+        // is based on another when its low falls inside the other's range
+        void SaveTypesRanges() {
+            var classes = Builder.Classes.Values.OrderBy(c => c.ID).ToList();
+            var derived = classes.Where(c => c.Base != null).ToLookup(c => c.Base);
+            var low = new Dictionary<Class, int>();
+            var high = new Dictionary<Class, int>();
+            int counter = 0;
+            void Number(Class cls) {
+                low[cls] = ++counter;
+                foreach (var child in derived[cls]) {
+                    Number(child);
+                }
+                high[cls] = counter;
+            }
+            foreach (var cls in classes.Where(c => c.Base == null || classes.Contains(c.Base) == false)) {
+                Number(cls);
+            }
+            SaveTypesRange("__TypesLow__", classes, low);
+            SaveTypesRange("__TypesHigh__", classes, high);
+        }
+
+        void SaveTypesRange(string name, List<Class> classes, Dictionary<Class, int> range) {
+            Writer.Write("static const int ");
+            Writer.Write(name);
+            Writer.Write("[");
+            Writer.Write(Class.CounterID + 1);
+            Writer.WriteLine("] = {");
+            foreach (var cls in classes) {
+                if (cls.ID < 0 || range.ContainsKey(cls) == false) continue;
+                Writer.Write("\t[");
+                Writer.Write(cls.ID);
+                Writer.Write("] = ");
+                Writer.Write(range[cls]);
+                Writer.WriteLine(",");
+            }
+            Writer.WriteLine("};\n");
+        }
+
         void SaveClassReflection(Class cls) {
+            //if (cls.Access == AccessType.STATIC || cls.Usage == 0) {
+            //    Writer.WriteLine("0, NULL\n};");
+            //    return;
+            //}
+            //var children = cls.Children.Where(c => c.Access != AccessType.STATIC && (c is Var v && v.Usage > 0 || c is Function f && f.Usage > 0)).ToList();
+            var children = cls.Children.Where(c => c.Access != AccessType.STATIC && c is not EnumMember).ToList();
+            if (cls.Token.Value is "ReflectionType" or "ReflectionMember" or "ReflectionArgument") {
+                children.Clear();
+            }
+            var index = SaveReflectionIndex("reflection_" + cls.Token.Value, children.Select(c => ReflectionHash(c.Token.Value)).ToList());
             Writer.Write("ReflectionType reflection_");
             Writer.Write(cls.Token.Value);
             Writer.WriteLine(" = {");
             Writer.Write("\t.name = \"");
             Writer.Write(cls.Token.Value);
-            Writer.Write("\", .id = ");
+            Writer.Write("\", .hash = ");
+            Writer.Write(ReflectionHash(cls.Token.Value));
+            Writer.Write("u, .id = ");
             Writer.Write(cls.ID);
             Writer.Write(", .based = ");
             Writer.Write(cls.Base?.ID ?? -1);
+            Writer.Write(", .index = ");
+            Writer.Write(index);
             Writer.Write(", .count = ");
-            //if (cls.Access == AccessType.STATIC || cls.Usage == 0) {
-            //    Writer.WriteLine("0, NULL\n};");
-            //    return;
-            //}
-            //var children = cls.Children.Where(c => c.Access != AccessType.STATIC && (c is Var v && v.Usage > 0 || c is Function f && f.Usage > 0)).ToList();
-            var children = cls.Children.ToList();
             Writer.Write(children.Count);
             if (children.Count > 0) {
                 Writer.Write(", .children = \n\t(ReflectionMember[");
@@ -260,15 +446,11 @@ namespace Run {
                 Writer.Write("]) {");
                 bool started = false;
                 foreach (var child in children) {
-                    if (child.Access == AccessType.STATIC) continue;
                     //switch (child) {
                     //    case Var v when v.Usage == 0:
                     //    case Function f when f.Usage == 0:
                     //        continue;
                     //}
-                    if (cls.Token.Value == "ReflectionType") continue;
-                    if (cls.Token.Value == "ReflectionMember") continue;
-                    if (cls.Token.Value == "ReflectionArgument") continue;
                     if (started)
                         Writer.Write(", ");
                     started = true;
@@ -283,7 +465,9 @@ namespace Run {
             Writer.WriteLine("\n\t\t{");
             Writer.Write("\t\t\t.name = \"");
             Writer.Write(child.Token.Value);
-            Writer.Write("\", .offset = ");
+            Writer.Write("\", .hash = ");
+            Writer.Write(ReflectionHash(child.Token.Value));
+            Writer.Write("u, .offset = ");
             if (child is Var && child is not GetterSetter) {
                 Writer.Write("offsetof(");
                 Writer.Write(cls.Real);
@@ -358,7 +542,7 @@ namespace Run {
         }
         void SaveChecks() {
             Writer.WriteLine("""
-                void NullException(int line, char* file) {
+                void NullException(int line, const char* file) {
                 	fprintf(stderr, "Null Exception Value\n  File '%s':%d\n", file, line);
                 	exit(-1);
                 }
@@ -447,6 +631,9 @@ namespace Run {
             });
             SaveMain();
             Writer.WriteLine("}");
+            if (Builder.Program.ProfileAllocations) {
+                SaveProfileSites();
+            }
             Writer.WriteLine("""
                 void interruptHandler(int signum) {
                    perror("Caught Interrupt");
@@ -481,6 +668,13 @@ namespace Run {
                         printf("Error while setting a signal handler.\n");
                     }
                     ArenaInit(64 * 1024);
+                """);
+            if (Builder.Program.ProfileAllocations) {
+                Writer.Write("\tProfileAtExit(__ProfileSites__, ");
+                Writer.Write(profileSites.Count);
+                Writer.WriteLine(", __ProfileTypeName__);");
+            }
+            Writer.WriteLine("""
                     run_initializer(argc, argv);
                     ArenaClose();
                     return 0;
@@ -663,8 +857,6 @@ namespace Run {
                     Writer.Write(" = ");
                     Save(f.Initializer);
                     Writer.WriteLine(";");
-                    SaveRegisterVar(f);
-                    Writer.WriteLine(";");
                 }
             }
         }
@@ -674,7 +866,7 @@ namespace Run {
             foreach (var child in cls.Children) {
                 if (child is Field f && f.Access == AccessType.STATIC) {
                     f.Real = cls.Token.Value + f.Real;
-                    Save(f, false, false);
+                    Save(f, false);
                     Writer.WriteLine(";");
                     newLine = true;
                 }
@@ -739,6 +931,11 @@ namespace Run {
                 }
             }
             Writer.Write("} ");
+            if (cls.Align > 0) {
+                Writer.Write("__attribute__((aligned(");
+                Writer.Write(cls.Align);
+                Writer.Write("))) ");
+            }
             Writer.Write(cls.Real);
             Writer.WriteLine(";\n");
 
@@ -821,8 +1018,21 @@ namespace Run {
                 if (enm.Usage == 0) {
                     //continue;
                 }
+                // a member is a constant named the way Mode.WRITE is written,
+                // _Mode__WRITE; one without a value follows the one before
+                string previous = null;
                 foreach (EnumMember child in enm.Children) {
-                    Save(child);
+                    var name = enm.Real + "__" + child.Token.Value;
+                    Writer.Write("#define ");
+                    Writer.Write(name);
+                    Writer.Write(' ');
+                    if (child.Content != null) {
+                        Save(child.Content);
+                    } else {
+                        Writer.Write(previous == null ? "0" : "(" + previous + " + 1)");
+                    }
+                    Writer.WriteLine();
+                    previous = name;
                     ok = true;
                 }
             }
@@ -833,6 +1043,554 @@ namespace Run {
         }
         #endregion
 
+        #region dispatch
+        readonly Dictionary<Function, List<Function>> implementations = [];
+
+        // the functions a call to func can run, one per class that can be behind it
+        List<Function> Implementations(Function func) {
+            if (implementations.TryGetValue(func, out var found)) return found;
+            found = [];
+            if (func.Parent is Class owner && func is not Constructor && func.Access == AccessType.INSTANCE && func.HasVariadic == false) {
+                foreach (var cls in Builder.Classes.Values) {
+                    if (Dispatchable(cls, owner) == false) continue;
+                    if (FindOverride(cls, func) is Function target && found.Contains(target) == false) {
+                        found.Add(target);
+                    }
+                }
+            }
+            implementations[func] = found;
+            return found;
+        }
+
+        // values have no block header to read the type from
+        static bool Dispatchable(Class cls, Class owner) => cls is not Interface && cls.ID >= 0 && cls.IsPrimitive == false && cls.IsEnum == false && cls.IsNative == false && cls.IsCompatible(owner);
+
+        static Function FindOverride(Class cls, Function func) {
+            for (var type = cls; type != null && type is not Interface; type = type.Base) {
+                foreach (var child in type.Children) {
+                    if (child is Function f && f is not Constructor && f.Access == AccessType.INSTANCE && f.Token.Value == func.Token.Value && SameParameters(f, func)) {
+                        return f;
+                    }
+                }
+            }
+            return null;
+        }
+
+        static bool SameParameters(Function a, Function b) {
+            var left = a.Parameters?.Children;
+            var right = b.Parameters?.Children;
+            if ((left?.Count ?? 0) != (right?.Count ?? 0)) return false;
+            for (int i = 0; i < (left?.Count ?? 0); i++) {
+                if ((left[i] as Parameter)?.Type?.Token.Value != (right[i] as Parameter)?.Type?.Token.Value) return false;
+            }
+            return true;
+        }
+
+        // the whole program is known, so a call with a single possible
+        // target is direct. null means the call goes through the table
+        Function Devirtualize(Function func) {
+            var targets = Implementations(func);
+            return targets.Count switch {
+                0 => func,
+                1 => targets[0],
+                _ => null,
+            };
+        }
+
+        // one table per overridden function, indexed by the type id the
+        // arena keeps in every block header, so a call is a load and an
+        // indirect jump
+        void SaveVirtualTables() {
+            foreach (var func in Builder.Functions.Values) {
+                if (func.IsNative || Devirtualize(func) != null) continue;
+                Writer.Write("typedef ");
+                SaveDeclaration(func, "(*" + func.Real + "_fn)");
+                Writer.WriteLine(";");
+                Writer.Write("static const ");
+                Writer.Write(func.Real);
+                Writer.Write("_fn __");
+                Writer.Write(func.Real);
+                Writer.Write("__[");
+                Writer.Write(Class.CounterID + 1);
+                Writer.WriteLine("] = {");
+                // every slot is set, a block of a type without an override of
+                // its own runs the declaring function rather than calling NULL
+                var classes = Builder.Classes.Values.Where(c => c.ID >= 0).GroupBy(c => c.ID).ToDictionary(g => g.Key, g => g.First());
+                for (int id = 0; id <= Class.CounterID; id++) {
+                    var target = classes.TryGetValue(id, out var cls) && Dispatchable(cls, func.Parent as Class) ? FindOverride(cls, func) ?? func : func;
+                    Writer.Write("	[");
+                    Writer.Write(id);
+                    Writer.Write("] = (");
+                    Writer.Write(func.Real);
+                    Writer.Write("_fn)");
+                    Writer.Write(target.Real);
+                    Writer.WriteLine(",");
+                }
+                Writer.WriteLine("};");
+                Writer.Write("static inline ");
+                SaveDeclaration(func, func.Real + "_virtual");
+                Writer.WriteLine(" {");
+                Writer.Write(func.Type == null ? "	__" : "	return __");
+                Writer.Write(func.Real);
+                Writer.Write("__[BLOCK_TYPE(this)](this");
+                foreach (var param in func.Parameters?.Children ?? []) {
+                    Writer.Write(", ");
+                    Writer.Write(param.Real);
+                }
+                Writer.WriteLine(", __region__);\n}\n");
+            }
+        }
+        #endregion
+
+        #region concatenation
+        static readonly HashSet<string> Signed = ["i64", "i32", "i16", "i8"];
+        static readonly HashSet<string> Unsigned = ["u64", "u32", "u16", "u8"];
+        bool hasConcat;
+
+        // a whole + chain of strings becomes one StringConcat call, that
+        // sizes the result before it allocates it once. Strings made from
+        // chars and numbers turned to chars are copied without the string
+        // in between, literals next to each other are joined by C
+        void SaveStringConcat() {
+            if (Builder.Classes.TryGetValue("string", out var cls) == false || cls.Usage == 0) return;
+            var ctor = cls.Children.OfType<Constructor>().FirstOrDefault(c => c.Parameters?.Children.Count == 1 && (c.Parameters.Children[0] as Parameter).Type?.Token.Value == "i32");
+            var size = cls.Children.OfType<GetterSetter>().FirstOrDefault(g => g.Token.Value == "size")?.Getter;
+            var value = cls.Children.OfType<Field>().FirstOrDefault(v => v.Token.Value == "value");
+            if (ctor == null || size == null || value == null) return;
+            hasConcat = true;
+            Writer.WriteLine("""
+                static int StringDigits(unsigned long long value) {
+                    int digits = 1;
+                    for (; value >= 10; value /= 10) digits++;
+                    return digits;
+                }
+
+                static char* StringWrite(char* out, unsigned long long value) {
+                    int digits = StringDigits(value);
+                    for (char* end = out + digits; end > out; value /= 10) *--end = '0' + value % 10;
+                    return out + digits;
+                }
+
+                """);
+            var code = """
+                static STRING* StringConcat(Region* region, int count, ...) {
+                    va_list args;
+                    int total = 0;
+                    va_start(args, count);
+                    for (int i = 0; i < count; i++) {
+                        switch (va_arg(args, int)) {
+                            case 0: { STRING* s = va_arg(args, STRING*); if (s) total += SIZE(s, region); break; }
+                            case 1: va_arg(args, const char*); total += va_arg(args, int); break;
+                            case 2: { long long n = va_arg(args, long long); total += StringDigits(n < 0 ? 0ULL - (unsigned long long)n : (unsigned long long)n) + (n < 0); break; }
+                            case 3: total += StringDigits(va_arg(args, unsigned long long)); break;
+                            case 4: { const char* c = va_arg(args, const char*); if (c) total += (int)strlen(c); break; }
+                        }
+                    }
+                    va_end(args);
+                    STRING* result = CTOR(NEW(STRING, 1, ID, region), total, region);
+                    char* out = (char*)result->VALUE;
+                    va_start(args, count);
+                    for (int i = 0; i < count; i++) {
+                        switch (va_arg(args, int)) {
+                            case 0: { STRING* s = va_arg(args, STRING*); if (s) { int n = SIZE(s, region); memcpy(out, s->VALUE, n); out += n; } break; }
+                            case 1: { const char* c = va_arg(args, const char*); int n = va_arg(args, int); memcpy(out, c, n); out += n; break; }
+                            case 2: { long long n = va_arg(args, long long); if (n < 0) *out++ = '-'; out = StringWrite(out, n < 0 ? 0ULL - (unsigned long long)n : (unsigned long long)n); break; }
+                            case 3: out = StringWrite(out, va_arg(args, unsigned long long)); break;
+                            case 4: { const char* c = va_arg(args, const char*); if (c) { int n = (int)strlen(c); memcpy(out, c, n); out += n; } break; }
+                        }
+                    }
+                    va_end(args);
+                    return result;
+                }
+
+                """;
+            Writer.WriteLine(code
+                .Replace("STRING", cls.Real)
+                .Replace("SIZE", size.Real)
+                .Replace("CTOR", ctor.Real)
+                .Replace("VALUE", value.Real)
+                .Replace("ID", cls.ID.ToString()));
+        }
+
+        static bool IsConcat(Function func) => func is Operator { Token.Value: "+" } && func.Parent is Class { Token.Value: "string" };
+
+        static void Flatten(Expression exp, List<Expression> parts) {
+            if (exp is CallExpression { Function: Function func } call && IsConcat(func) && call.Caller is Expression left && call.Arguments.Count == 1) {
+                Flatten(left, parts);
+                Flatten(call.Arguments[0], parts);
+                return;
+            }
+            // the chars a string was made from for the +
+            var ctor = exp switch {
+                NewExpression { Content: ConstructorExpression c } => c,
+                ConstructorExpression c => c,
+                _ => null,
+            };
+            if (ctor?.Function?.Parent is Class { Token.Value: "string" } && ctor.Arguments.Count == 1 && ctor.Arguments[0].Type?.Token.Value == "chars") {
+                exp = ctor.Arguments[0];
+            }
+            parts.Add(exp);
+        }
+
+        static bool IsLiteral(Expression exp) => exp is LiteralExpression { Token.Value: ['"', ..] };
+
+        bool SaveConcat(CallExpression call) {
+            if (hasConcat == false) return false;
+            var parts = new List<Expression>();
+            Flatten(call, parts);
+            Writer.Write("StringConcat(__current_region__, ");
+            Writer.Write(parts.Where((p, i) => i == 0 || IsLiteral(p) == false || IsLiteral(parts[i - 1]) == false).Count());
+            for (int i = 0; i < parts.Count; i++) {
+                var part = parts[i];
+                if (IsLiteral(part)) {
+                    var literal = part.Token.Value;
+                    for (; i + 1 < parts.Count && IsLiteral(parts[i + 1]); i++) {
+                        literal += " " + parts[i + 1].Token.Value;
+                    }
+                    Writer.Write(", 1, ");
+                    Writer.Write(literal);
+                    Writer.Write(", (int)sizeof(");
+                    Writer.Write(literal);
+                    Writer.Write(") - 1");
+                    continue;
+                }
+                if (part is CallExpression { Function.Token.Value: "toString", Arguments.Count: 0, Caller: Expression number } && number.Type?.Token.Value is string name && (Signed.Contains(name) || Unsigned.Contains(name))) {
+                    Writer.Write(Signed.Contains(name) ? ", 2, (long long)(" : ", 3, (unsigned long long)(");
+                    Save(number);
+                    Writer.Write(')');
+                    continue;
+                }
+                Writer.Write(part.Type?.Token.Value == "chars" ? ", 4, (const char*)(" : ", 0, (" + Builder.Classes["string"].Real + "*)(");
+                Save(part);
+                Writer.Write(')');
+            }
+            Writer.Write(')');
+            return true;
+        }
+        #endregion
+
+        #region literals
+        readonly Dictionary<string, int> literals = [];
+        Class literalClass;
+        Field literalValue, literalSize, literalHash;
+
+        // a literal the @implicit constructor turns into a string is laid out
+        // once, as a static string with its size and hash already set. The
+        // header marks it as a scope block, so delete leaves it alone
+        void FindLiteralFields() {
+            if (Builder.Classes.TryGetValue("string", out var cls) == false || cls.Usage == 0) return;
+            literalValue = cls.Children.OfType<Field>().FirstOrDefault(v => v.Token.Value == "value");
+            literalSize = cls.Children.OfType<Field>().FirstOrDefault(v => v.Token.Value == "_size");
+            literalHash = cls.Children.OfType<Field>().FirstOrDefault(v => v.Token.Value == "hash");
+            if (literalValue != null && literalSize != null && literalHash != null) literalClass = cls;
+        }
+
+        bool SaveLiteral(NewExpression exp) {
+            if (exp.IsImplicit == false || exp.Content is not ConstructorExpression { Arguments: [LiteralExpression literal] } ctor) return false;
+            return ctor.Function?.Parent == literalClass && SaveLiteral(literal);
+        }
+
+        bool SaveLiteral(LiteralExpression literal) {
+            if (literalClass == null || IsLiteral(literal) == false) return false;
+            if (literals.TryGetValue(literal.Token.Value, out var index) == false) {
+                index = literals.Count;
+                literals.Add(literal.Token.Value, index);
+            }
+            Writer.Write("(&__literals__[");
+            Writer.Write(index);
+            Writer.Write("].value)");
+            return true;
+        }
+
+        void SaveLiterals() {
+            if (literals.Count == 0) return;
+            Writer.Write("static struct { BlockHeader header; ");
+            Writer.Write(literalClass.Real);
+            Writer.WriteLine(" value; } __literals__[] = {");
+            foreach (var literal in literals.OrderBy(l => l.Value).Select(l => l.Key)) {
+                Writer.Write("    {{NULL, sizeof(");
+                Writer.Write(literalClass.Real);
+                Writer.Write("), ");
+                Writer.Write(literalClass.ID);
+                Writer.Write(", ARENA_SCOPE_ZONE}, {.");
+                Writer.Write(literalValue.Real);
+                Writer.Write(" = ");
+                Writer.Write(literal);
+                Writer.Write(", .");
+                Writer.Write(literalSize.Real);
+                Writer.Write(" = (int)sizeof(");
+                Writer.Write(literal);
+                Writer.Write(") - 1, .");
+                Writer.Write(literalHash.Real);
+                Writer.Write(" = ");
+                // the string computes it itself when the escapes aren't known here
+                Writer.Write(Unescape(literal) is byte[] bytes ? TextHash(bytes) : -1);
+                Writer.WriteLine("}},");
+            }
+            Writer.WriteLine("};\n");
+        }
+
+        // the bytes of a C string literal
+        static byte[] Unescape(string literal) {
+            var bytes = new List<byte>();
+            var text = literal[1..^1];
+            for (int i = 0; i < text.Length; i++) {
+                if (text[i] != '\\') {
+                    int next = char.IsSurrogatePair(text, i) ? 2 : 1;
+                    bytes.AddRange(Encoding.UTF8.GetBytes(text.Substring(i, next)));
+                    i += next - 1;
+                    continue;
+                }
+                if (++i == text.Length) return null;
+                switch (text[i]) {
+                    case 'n': bytes.Add((byte)'\n'); break;
+                    case 't': bytes.Add((byte)'\t'); break;
+                    case 'r': bytes.Add((byte)'\r'); break;
+                    case 'a': bytes.Add(7); break;
+                    case 'b': bytes.Add(8); break;
+                    case 'f': bytes.Add(12); break;
+                    case 'v': bytes.Add(11); break;
+                    case 'e': bytes.Add(27); break;
+                    case '\\' or '\'' or '"' or '?': bytes.Add((byte)text[i]); break;
+                    case >= '0' and <= '7': {
+                            int value = 0, n = 0;
+                            for (; n < 3 && i < text.Length && text[i] is >= '0' and <= '7'; n++, i++) value = value * 8 + text[i] - '0';
+                            bytes.Add((byte)value);
+                            i--;
+                            break;
+                        }
+                    case 'x': {
+                            int value = 0, n = 0;
+                            for (i++; i < text.Length && Uri.IsHexDigit(text[i]); n++, i++) value = value * 16 + Convert.ToInt32(text[i].ToString(), 16);
+                            if (n == 0) return null;
+                            bytes.Add((byte)value);
+                            i--;
+                            break;
+                        }
+                    default:
+                        return null;
+                }
+            }
+            return [.. bytes];
+        }
+
+        // TextHash of lib/text.h, word reads in the byte order of this machine like memcpy there
+        static int TextHash(byte[] text) {
+            unchecked {
+                ulong h = 0x9E3779B97F4A7C15UL ^ (ulong)text.Length;
+                int i = 0;
+                for (; i + 8 <= text.Length; i += 8) {
+                    h = (h ^ BitConverter.ToUInt64(text, i)) * 0xBF58476D1CE4E5B9UL;
+                    h ^= h >> 31;
+                }
+                ulong tail = 0;
+                for (int shift = 0; i < text.Length; i++, shift += 8) {
+                    tail |= (ulong)text[i] << shift;
+                }
+                h = (h ^ tail) * 0x94D049BB133111EBUL;
+                h ^= h >> 29;
+                int hash = (int)(h ^ (h >> 32));
+                return hash == -1 ? 0x7FFFFFFF : hash;
+            }
+        }
+        #endregion
+
+        #region inlining
+        // accessors and => functions are small enough for the C compiler to
+        // inline, @inline asks it to always do it
+        void SaveLinkage(Function func) {
+            if (func.Pointer != null || func is Main || func is Constructor) return;
+            if (IsAnnotated(func, "inline") || func.Parent is GetterSetter property && IsAnnotated(property, "inline")) {
+                Writer.Write("INLINE ");
+            } else if (func.Parent is GetterSetter || func.IsArrow) {
+                Writer.Write("static inline ");
+            }
+        }
+
+        static bool IsAnnotated(AST ast, string name) => ast.Annotations?.Exists(a => a.Token.Value == name) ?? false;
+
+        // what a function does, when it is a single expression
+        static Expression Body(Function func) {
+            AST body = null;
+            foreach (var child in func.Children) {
+                if (child == func.Parameters) continue;
+                if (body != null) return null;
+                body = child;
+            }
+            return body switch {
+                Return ret => ret.Content as Expression,
+                Expression exp when func.IsArrow || func.Type == null => exp,
+                _ => null,
+            };
+        }
+
+        // the field of this an expression reads
+        static Var FieldOf(Expression exp) => exp switch {
+            IdentifierExpression { From: Field { Access: not AccessType.STATIC } f } => f,
+            DotExpression { Left: ThisExpression or IdentifierExpression { Token.Value: "this" }, Right: IdentifierExpression { From: Field { Access: not AccessType.STATIC } f } } => f,
+            _ => null,
+        };
+
+        // the parameter an expression is, as an index into the call arguments
+        static int ParameterOf(Function func, Expression exp) {
+            if (exp is not IdentifierExpression { From: Parameter p }) return -1;
+            return func.Parameters?.Children.IndexOf(p) ?? -1;
+        }
+
+        // accessors that only read or write a field, or one item of an array
+        // field, become that access at the call site, even under tcc
+        bool SaveInlined(CallExpression call, Function target) {
+            if (target.IsNative || target.HasVariadic || target.HasDefers || target.Access == AccessType.STATIC) return false;
+            var body = Body(target);
+            Expression value = null;
+            if (body is BinaryExpression { Token.Value: "=" } assign && target.Type == null) {
+                if ((value = assign.Right) == null || ParameterOf(target, value) < 0) return false;
+                body = assign.Left;
+            }
+            var index = -1;
+            if (body is IndexerExpression item) {
+                if ((index = ParameterOf(target, item.Right)) < 0) return false;
+                body = item.Left;
+            }
+            if (FieldOf(body) is not Var field || call.Arguments.Count != (target.Parameters?.Children.Count ?? 0)) return false;
+            var cast = target != call.Function;
+            Writer.Write(cast ? "((" + target.Parent.Real + "*)" : "(");
+            SaveChecked(call.Caller);
+            Writer.Write(")->");
+            Writer.Write(field.Real);
+            if (index >= 0) {
+                Writer.Write('[');
+                Save(call.Arguments[index]);
+                Writer.Write(']');
+            }
+            if (value != null) {
+                Writer.Write(" = ");
+                Save(call.Arguments[ParameterOf(target, value)]);
+            }
+            return true;
+        }
+        #endregion
+
+        #region parallel
+        readonly List<string> parallelTasks = [];
+        Dictionary<Var, string> captured = [];
+        int parallelCounter;
+
+        bool HasParallel() => Builder.Program.FindChildren<For>().Any(f => f.IsParallel);
+
+        // thread.h and atomic.h only build with gcc or clang
+        bool HasThreads() => HasParallel() || Builder.Program.FindChildren<AST>().Any(a => a.Annotations != null && a.Annotations.Any(n => n.IsHeader && n.Value is "../lib/thread.h" or "../lib/atomic.h"));
+
+        // Thread.start hands this to the new thread, it runs the run of the object
+        void SaveThreadEntry() {
+            if (Builder.Classes.TryGetValue("Thread", out var cls) == false) return;
+            var run = cls.Children.OfType<Function>().FirstOrDefault(f => f.Token.Value == "run" && (f.Parameters?.Children.Count ?? 0) == 0);
+            if (run == null) return;
+            Writer.Write("static void __thread_run__(void* this) {\n\t");
+            Writer.Write(Devirtualize(run)?.Real ?? run.Real + "_virtual");
+            Writer.WriteLine("(this, NULL);\n}\n");
+        }
+
+        // the body of a parallel for becomes a task over a part of the range.
+        // The locals it uses are reached through pointers in a context the
+        // loop keeps on its stack, ThreadParallelFor returns once all parts ran
+        void SaveParallel(For exp) {
+            var func = exp.FindParent<Function>();
+            var name = "__parallel_" + parallelCounter++ + "__";
+            var index = exp.Start as Var;
+            var range = index?.Initializer as RangeExpression;
+            var locals = new List<Var>();
+            foreach (var node in exp.Children.SelectMany(Validator.Nodes)) {
+                if (node is not IdentifierExpression { From: Var v } || v is Field || v is Global || v == index) continue;
+                // names can resolve to a loop variable of an earlier loop, only what is in scope here is shared
+                if (locals.Contains(v) || v.FindParent<Function>() != func || (v is not Parameter && v.Parent != func && IsInside(exp, v.Parent) == false)) continue;
+                locals.Add(v);
+            }
+            var owner = func.Access == AccessType.INSTANCE ? func.Parent as Class : null;
+
+            Writer.WriteLine("{");
+            Writer.Write("int __from__ = ");
+            if (range != null) {
+                Save(range.Left);
+            } else {
+                Writer.Write('0');
+            }
+            Writer.WriteLine(";");
+            Writer.Write("void* __context__[] = {&__from__");
+            foreach (var v in locals) {
+                Writer.Write(", &");
+                Save(new IdentifierExpression { Token = v.Token, From = v });
+            }
+            Writer.WriteLine(owner == null ? "};" : owner.IsPrimitive ? ", &this};" : ", this};");
+            Writer.Write("ThreadParallelFor((");
+            Save(range?.Right ?? exp.Condition);
+            Writer.Write(") - __from__, ");
+            Writer.Write(name);
+            Writer.WriteLine(", __context__);");
+            Writer.WriteLine("}");
+
+            var code = Writer;
+            var outer = captured;
+            captured = [];
+            var types = locals.Select(TypeOf).ToList();
+            for (int i = 0; i < locals.Count; i++) {
+                captured[locals[i]] = "(*(" + types[i] + "*)__captured__[" + (i + 1) + "])";
+            }
+            Writer = new StringWriter();
+            Writer.Write("static void ");
+            Writer.Write(name);
+            Writer.WriteLine("(void* __context__, int __start__, int __end__) {");
+            Writer.WriteLine("void** __captured__ = __context__;");
+            Writer.WriteLine("Region* __current_region__ = NULL;");
+            Writer.WriteLine("int __from__ = *(int*)__captured__[0];");
+            if (owner != null) {
+                Writer.Write(owner.Real);
+                Writer.Write(owner.IsPrimitive ? " this = *(" : "* this = (");
+                Writer.Write(owner.Real);
+                Writer.Write("*)__captured__[");
+                Writer.Write(locals.Count + 1);
+                Writer.WriteLine("];");
+            }
+            var counter = index?.Real ?? "range_" + exp.Token.Position;
+            Writer.Write("for(int ");
+            Writer.Write(counter);
+            Writer.Write(" = __from__ + __start__; ");
+            Writer.Write(counter);
+            Writer.Write(" < __from__ + __end__; ");
+            Writer.Write(counter);
+            Writer.WriteLine("++) {");
+            SaveBlock(exp);
+            Writer.WriteLine("}\n}\n");
+            parallelTasks.Add(Writer.ToString());
+            Writer = code;
+            captured = outer;
+        }
+
+        static bool IsAtomic(Expression exp) => exp switch {
+            IdentifierExpression { From: Var v } => v.IsAtomic,
+            DotExpression dot => IsAtomic(dot.Right),
+            _ => false,
+        };
+
+        static bool IsInside(AST ast, AST block) {
+            for (var parent = ast.Parent; parent != null && parent is not Function; parent = parent.Parent) {
+                if (parent == block) return true;
+            }
+            return false;
+        }
+
+        // the C type of a local, as its declaration writes it
+        string TypeOf(Var v) {
+            var code = Writer;
+            Writer = new StringWriter();
+            Save(v, false);
+            var text = Writer.ToString();
+            Writer = code;
+            text = text[..^(v.Real ?? v.Token.Value).Length];
+            return text.StartsWith("const ") ? text[6..] : text;
+        }
+        #endregion
+
         #region functions
         bool SaveFunctionsPrototypes() {
             bool ok = false;
@@ -850,6 +1608,7 @@ namespace Run {
                     }
                 }
                 //if (func.Parent is GetterSetter) continue;
+                SaveLinkage(func);
                 SaveDeclaration(func);
                 Writer.WriteLine(";");
                 ok = true;
@@ -886,15 +1645,19 @@ namespace Run {
         }
 
         void Save(DotExpression exp) {
-            Save(exp.Left);
+            SaveChecked(exp.Left);
             Writer.Write(exp.Left.Type?.IsEnum ?? false ? "_" : "->");
             Save(exp.Right);
         }
 
         void Save(BinaryExpression exp) {
+            // bitwise operators bind tighter in Run than in C
+            var bitwise = exp.Token.Type is TokenType.BITWISE_AND or TokenType.BITWISE_OR or TokenType.XOR;
+            if (bitwise) Writer.Write('(');
             Save(exp.Left);
             Writer.Write(exp.Token.Value);
             Save(exp.Right);
+            if (bitwise) Writer.Write(')');
         }
 
         void Save(AssignExpression exp) {
@@ -926,11 +1689,18 @@ namespace Run {
             switch (ast) {
                 case Constructor ctor:
                     if (exp.Parent == ctor) return false;
+                    if (ctor.Parent == literalClass && exp.Right is LiteralExpression literal && IsLiteral(literal)) {
+                        SaveReturnType(ctor);
+                        Save(exp.Left);
+                        Writer.Write(" = ");
+                        return SaveLiteral(literal);
+                    }
                     SaveReturnType(ctor);
                     Save(exp.Left);
                     Writer.Write(" = ");
                     Writer.Write(ctor.Real);
-                    Writer.Write("(NEW(");
+                    Writer.Write('(');
+                    SaveNew(exp.Token);
                     Writer.Write(ctor.Type.Real ?? ctor.Type.Token.Value);
                     Writer.Write(",1,");
                     Writer.Write(ctor.Type.ID);
@@ -1005,49 +1775,57 @@ namespace Run {
             Writer.Write("this");
         }
 
-        bool CheckSavePosition(bool savePosition, Block block) {
-            if (savePosition) {
-                savePosition = block.Contains<IsExpression>(true);
-            }
-            if (savePosition) {
-                SaveMapPosition(block);
-            }
-            return savePosition;
+        // base.f() runs the function of the base on this
+        void Save(Base b) {
+            Writer.Write("((");
+            Writer.Write(b.Owner.Base.Real);
+            Writer.Write("*)this)");
         }
 
-        bool AddRegion(Block block) {
-            bool add = false;
-            if (block.Children.Count > 0) {
-                if ((add = block.Contains(a => (a is Var v && v.Initializer is NewExpression), false))) {
-                    Writer.Write("__current_region__");
-                    //Writer.Write(block.Token.Position);
-                    Writer.WriteLine(" = RegionAdd(__current_region__, __current_region__->capacity);");
-                }
+        // closes the regions of the scopes a jump from 'from' to 'to' leaves,
+        // closing the outermost one takes all the nested regions with it
+        void SaveScopesExit(AST from, AST to) {
+            Scope outer = null;
+            for (var ast = from; ast != null && ast != to; ast = ast.Parent) {
+                if (ast is Scope scope) outer = scope;
+                if (ast is Function) break;
             }
-            return add;
+            if (outer != null) SaveScopeClose(outer);
         }
 
-        void CloseOrResetRegion(bool added, Block block) {
-            if (added == false) return;
+        void SaveScopeClose(Scope scope) {
+            Writer.Write("RegionClose(__SCOPE__");
+            Writer.Write(scope.ID);
+            Writer.WriteLine(");");
+            Writer.Write("__current_region__ = __SCOPE_PARENT__");
+            Writer.Write(scope.ID);
+            Writer.WriteLine(";");
+        }
 
-            if (block is not For) {
-                Writer.Write("RegionClose(__current_region__");
-            } else {
-                Writer.Write("RegionReset(__current_region__");
+        static Block FindDefers(AST ast) {
+            for (; ast != null; ast = ast.Parent) {
+                if (ast is Block block && block is not Defer && block.Defers.Count > 0) return block;
+                if (ast is Function) break;
             }
-            //Writer.Write(block.Token.Position);
-            Writer.WriteLine(");");
+            return null;
         }
 
-        void SaveBlock(Block block, bool savePosition = true) {
+        void SaveGotoDefers(Block block) {
+            if (block == null) {
+                Writer.WriteLine("goto __DONE__;");
+                return;
+            }
+            Writer.Write("goto __DEFER__");
+            Writer.Write(block.Defers[0].ID);
+            Writer.WriteLine(";");
+        }
+
+        void SaveBlock(Block block) {
             if (block.Defers.Count > 0) {
                 Writer.Write("int __DEFER_STAGE__");
                 Writer.Write(block.Defers[0].ID);
                 Writer.WriteLine(" = 0;");
             }
-            bool addRegion = AddRegion(block);
-            savePosition = CheckSavePosition(savePosition, block);
-
             for (int i = 0; i < block.Children.Count; i++) {
                 var child = block.Children[i];
                 if (child is Parameter) continue;
@@ -1055,10 +1833,6 @@ namespace Run {
                 Writer.Write(child is Expression ? ";\n" : "");
                 Writer.Write(child is Var ? ";\n" : "");
             }
-
-            CloseOrResetRegion(addRegion, block);
-            if (savePosition) RestoreMapPosition(block);
-
             SaveDefers(block);
         }
 
@@ -1078,13 +1852,13 @@ namespace Run {
                 SaveBlock(defer);
                 Writer.WriteLine("}");
             }
-            if (block.Parent is Block p && p is not Class) {
-                if (p.Defers.Count > 0) {
-                    Writer.Write("goto __DEFER__");
-                    Writer.Write(p.Defers[0].ID);
-                    Writer.WriteLine(";");
-                }
-            }
+            if (block is Function) return;
+            // a return got here, carry it on to the outer defers
+            var next = FindDefers(block.Parent);
+            Writer.WriteLine("if (__RETURNING__) {");
+            SaveScopesExit(block, next ?? block.FindParent<Function>());
+            SaveGotoDefers(next);
+            Writer.WriteLine("}");
         }
 
         void Save(AST exp) {
@@ -1105,6 +1879,7 @@ namespace Run {
                 case AsExpression a: Save(a); break;
                 case Ref r: Save(r); break;
                 case ThisExpression t: Save(t); break;
+                case Base b: Save(b); break;
                 case AssignExpression a: Save(a); break;
                 case BinaryExpression b: Save(b); break;
                 case TernaryExpression t: Save(t); break;
@@ -1119,6 +1894,7 @@ namespace Run {
                 case Return r: Save(r); break;
                 case Delete d: Save(d); break;
                 case Scope s: Save(s); break;
+                case Defer d: Save(d); break;
                 case Label l: Save(l); break;
                 case Parameter p: Save(p); break;
                 case Indexer i: Save(i); break;
@@ -1128,7 +1904,7 @@ namespace Run {
                 case GetterSetter g: Save(g); break;
                 case Function f: Save(f); break;
                 case Var v: Save(v); break;
-                case Block b: SaveBlock(b, false); break;
+                case Block b: SaveBlock(b); break;
             }
         }
 
@@ -1150,10 +1926,10 @@ namespace Run {
             return cls;
         }
 
-        void SaveDeclaration(Function exp) {
+        void SaveDeclaration(Function exp, string name = null) {
             var cls = SaveReturnType(exp);
             Writer.Write(" ");
-            Writer.Write(exp.Real);
+            Writer.Write(name ?? exp.Real);
             Writer.Write("(");
             bool started = false;
             if (cls != null && exp.Access == AccessType.INSTANCE) {
@@ -1182,24 +1958,11 @@ namespace Run {
             Writer.Write(")");
         }
 
-        void SaveMapPosition(AST ast) {
-            if (ast == null || ast.Token == null) return;
-            Writer.Write("int __mapPosition");
-            Writer.Write(ast.Token.Position);
-            Writer.WriteLine(" = mapSize;");
-        }
-
-        void RestoreMapPosition(AST ast) {
-            if (ast == null || ast.Token == null) return;
-            Writer.Write("mapSize = __mapPosition");
-            Writer.Write(ast.Token.Position);
-            Writer.WriteLine(";");
-        }
-
         void Save(Function exp) {
             if (exp.IsNative) {
                 return;
             }
+            SaveLinkage(exp);
             SaveDeclaration(exp);
             if (exp.Pointer != null) {
                 Writer.Write(" = ");
@@ -1208,6 +1971,9 @@ namespace Run {
             }
             Writer.WriteLine(" {");
             Writer.WriteLine("Region* __current_region__ = __region__;");
+            if (exp.HasDefers) {
+                Writer.WriteLine("bool __RETURNING__ = false;");
+            }
             if (exp is Constructor) {
                 var cls = exp.Parent as Class;
                 if (cls.IsBased) {
@@ -1279,7 +2045,9 @@ namespace Run {
             var vary = exp.Parameters.Children.Last() as Parameter;
             Writer.Write("_array* ");
             Writer.Write(vary.Real);
-            Writer.Write(" = array_this_i32_i32(array_initializer(NEW(_array, 1, 2, __current_region__)), (_i32){0, sizeof(");
+            Writer.Write(" = array_this_i32_i32(array_initializer(");
+            SaveNew(vary.Token);
+            Writer.Write("_array, 1, 2, __current_region__)), (_i32){0, sizeof(");
             SaveType(vary.Type);
             Writer.Write(")}, len");
             Writer.Write(vary.Real);
@@ -1356,7 +2124,7 @@ namespace Run {
             Writer.Write(')');
         }
 
-        void Save(Var exp, bool saveInitializer = true, bool registerVar = true) {
+        void Save(Var exp, bool saveInitializer = true) {
             if (exp.IsConst) {
                 Writer.Write("const ");
             }
@@ -1380,6 +2148,8 @@ namespace Run {
                     Error.NullType(exp);
                     return;
                 }
+                // _Atomic(T) keeps a pointer atomic instead of what it points to
+                if (exp.IsAtomic) Writer.Write("_Atomic(");
                 Writer.Write(exp.Type.Real ?? exp.Type.Token.Value);
                 Writer.Write(' ');
                 switch (exp.Initializer) {
@@ -1394,50 +2164,37 @@ namespace Run {
                 if (exp.Type.IsPrimitive == false) {
                     Writer.Write('*');
                 }
+                if (exp.IsAtomic) Writer.Write(") ");
             }
             Writer.Write(exp.Real ?? exp.Token.Value);
             if (saveInitializer && exp.FindParent<Function>() != null) {
-                SaveInitializer(exp, exp.TypeArray, registerVar);
+                SaveInitializer(exp, exp.TypeArray);
             }
         }
-        void SaveInitializer(Var exp, bool array = true, bool registerVar = true) {
-            if (array && exp.Arguments != null) {
+        void SaveInitializer(Var exp, bool array = true) {
+            // a:T[] without a size is a pointer, only a:T[n] lives on the stack
+            if (array && exp.Arguments?.Count > 0) {
                 Writer.Write('[');
-                if (exp.Arguments.Count > 0) {
-                    Save(exp.Arguments[0]);
-                }
+                Save(exp.Arguments[0]);
                 Writer.Write(']');
             } else if (exp.Initializer != null && exp.Parent is not Class) {
                 Writer.Write(" = ");
                 Save(exp.Initializer);
-                if (exp.NeedRegister || registerVar) {
-                    Writer.WriteLine(";");
-                    SaveRegisterVar(exp);
-                }
             }
         }
 
-        void SaveRegisterVar(Var exp, string value = null) {
-            Writer.Write("REGISTER(");
-            if (exp.Type.IsPrimitive) {
-                Writer.Write("&");
-            }
-            Writer.Write(exp.Real);
-            Writer.Write(", ");
-            Writer.Write(exp.Type.ID);
-            Writer.Write(")");
-        }
-
         void Save(Label exp) {
             Writer.Write(exp.Token.Value);
             Writer.WriteLine(':');
         }
 
         void Save(Break exp) {
+            SaveScopesExit(exp.Parent, exp.FindParent<For>());
             Writer.WriteLine("break;");
         }
 
         void Save(Continue exp) {
+            SaveScopesExit(exp.Parent, exp.FindParent<For>());
             Writer.WriteLine("continue;");
         }
 
@@ -1454,9 +2211,19 @@ namespace Run {
         }
 
         void Save(Scope exp) {
-            Writer.Write("SCOPE(");
-            Writer.Write(exp.Token.Value);
-            Writer.Write(")");
+            Writer.WriteLine("{");
+            Writer.Write("Region* __SCOPE_PARENT__");
+            Writer.Write(exp.ID);
+            Writer.WriteLine(" = __current_region__;");
+            Writer.Write("Region* __SCOPE__");
+            Writer.Write(exp.ID);
+            Writer.WriteLine(" = RegionAdd(__current_region__, __current_region__->capacity);");
+            Writer.Write("__current_region__ = __SCOPE__");
+            Writer.Write(exp.ID);
+            Writer.WriteLine(";");
+            SaveBlock(exp);
+            SaveScopeClose(exp);
+            Writer.WriteLine("}");
         }
 
         void Save(TypeOf exp) {
@@ -1499,18 +2266,17 @@ namespace Run {
                 Save(exp.Content);
                 Writer.WriteLine(";");
             }
-            var block = exp.Parent as Block;
-            if (block.Defers.Count == 0) {
-                Writer.Write("goto __DONE__");
-            } else {
-                Writer.Write("goto __DEFER__");
-                Writer.Write(block.Defers[0].ID);
+            var block = FindDefers(exp.Parent);
+            SaveScopesExit(exp.Parent, block ?? func);
+            if (block != null) {
+                Writer.WriteLine("__RETURNING__ = true;");
             }
-            Writer.WriteLine(";");
+            SaveGotoDefers(block);
         }
 
         void Save(Ref exp) {
-            if (exp.Content.Type.IsPrimitive) {
+            // the atomic functions work on the address of an @atomic reference too
+            if (exp.Content.Type.IsPrimitive || IsAtomic(exp.Content)) {
                 Writer.Write("&(");
             } else
             if (exp.Content.Type.IsNumber) {
@@ -1530,7 +2296,7 @@ namespace Run {
         void SaveBegin(For exp) {
             var var = exp.Start as Var;
             Writer.Write("for(");
-            Save(var, true, false);
+            Save(var, true);
             Writer.Write(";;");
             Writer.Write(var.Real);
             Writer.Write("++");
@@ -1591,7 +2357,7 @@ namespace Run {
         void SaveDefaultFor(For exp) {
             Writer.Write("for(");
             if (exp.Start is Var v) {
-                Save(v, true, false);
+                Save(v, true);
             } else {
                 Save(exp.Start);
             }
@@ -1630,7 +2396,10 @@ namespace Run {
         }
 
         void Save(For exp) {
-            SaveMapPosition(exp);
+            if (exp.IsParallel) {
+                SaveParallel(exp);
+                return;
+            }
             switch (exp.Stage) {
                 case -1: Writer.Write("while(1"); break;
                 case 0 when exp.HasRange: SaveUntil(exp); break;
@@ -1652,7 +2421,6 @@ namespace Run {
             } else {
                 Writer.WriteLine(");");
             }
-            RestoreMapPosition(exp);
         }
 
         void Save(If exp) {
@@ -1672,10 +2440,13 @@ namespace Run {
         void Save(Delete exp) {
             for (int i = 0; i < exp.Block.Children.Count; i++) {
                 var child = exp.Block.Children[i];
-                if (child is IdentifierExpression id && id.Type is Class cls && cls.Dispose != null) {
+                // an object is disposed before its memory goes, an array
+                // of them only loses its storage
+                if (child is IdentifierExpression id && (id.From is Var v && v.TypeArray) == false && id.Type is Class cls && cls.Dispose != null) {
+                    Writer.Write(cls.Dispose.Real);
                     Writer.Write("(");
-                    Writer.Write(id.Token.Value);
-                    Writer.WriteLine(");");
+                    Save(child);
+                    Writer.WriteLine(",__current_region__);");
                 }
                 Writer.Write("DELETE(");
                 Save(child);
@@ -1686,29 +2457,111 @@ namespace Run {
         }
 
         void Save(NewExpression exp) {
+            if (SaveLiteral(exp)) return;
             if (exp.Content is ArrayCreationExpression array) {
-                Writer.Write("NEW(");
+                SaveNew(exp.Token);
                 Writer.Write(array.Type.Real ?? array.Type.Token.Value);
+                // arrays of objects hold references
+                if (array.Type.IsPrimitive == false && array.Type.IsNative == false) {
+                    Writer.Write('*');
+                }
                 Writer.Write(",");
                 Save(array.Content);
                 Writer.Write(",");
                 Writer.Write(array.Type.ID);
                 Writer.Write(",__current_region__");
             } else if (exp.Content is ConstructorExpression ctor) {
-                Save(ctor, exp.Type);
+                Save(ctor, exp.Type, exp.IsScoped);
             } else {
                 Debugger.Break();
             }
             Writer.Write(')');
         }
 
-        void Save(CallExpression call, Class type) {
+        // with --safe a dereference the validator couldn't prove goes through CHECK_<Type>
+        void SaveChecked(ValueType exp) {
+            if (NeedsCheck(exp) == false) {
+                Save(exp);
+                return;
+            }
+            Writer.Write("CHECK_");
+            Writer.Write(exp.Type.Token.Value);
+            Writer.Write('(');
+            Save(exp);
+            Writer.Write(", ");
+            Writer.Write(SourceLine(exp.Token));
+            Writer.Write(", \"");
+            Writer.Write((exp.Token?.Scanner?.Path ?? Builder.Program.Token.Value).Replace('\\', '/'));
+            Writer.Write("\")");
+        }
+
+        bool NeedsCheck(ValueType exp) {
+            if (Builder.Program.SafeMode == false || exp is Expression { NotNull: true }) return false;
+            if (exp.Type is not Class cls || cls.IsEnum || cls.IsPrimitive || cls.Access == AccessType.STATIC || cls.Usage == 0) return false;
+            return exp switch {
+                ThisExpression or NewExpression or TypeExpression => false,
+                IdentifierExpression { From: Class } => false,
+                IdentifierExpression { From: Array { TypeArray: true } } => false,
+                _ => true,
+            };
+        }
+
+        // with --profile-alloc every allocation names its source line
+        void SaveNew(Token token) {
+            if (Builder.Program.ProfileAllocations == false) {
+                Writer.Write("NEW(");
+                return;
+            }
+            Writer.Write("PROFILE_NEW(");
+            Writer.Write(profileSites.Count);
+            Writer.Write(',');
+            profileSites.Add(token);
+        }
+
+        void SaveProfileSites() {
+            Writer.WriteLine("""
+                static const char* __ProfileTypeName__(int id) {
+                    return id >= 0 && id < __TypesCount__ && __TypesMap__[id] ? __TypesMap__[id]->name : NULL;
+                }
+                """);
+            Writer.WriteLine("static const ProfileSite __ProfileSites__[] = {");
+            foreach (var token in profileSites) {
+                Writer.Write("\t{\"");
+                Writer.Write((token?.Scanner?.Path ?? Builder.Program.Token.Value).Replace('\\', '/'));
+                Writer.Write("\", ");
+                Writer.Write(SourceLine(token));
+                Writer.WriteLine("},");
+            }
+            Writer.WriteLine("\t{0, 0}\n};\n");
+        }
+
+        // the scanner line can drift after rollbacks, the position does not
+        static int SourceLine(Token token) {
+            var data = token?.Scanner?.Data;
+            if (data == null) return token?.Line ?? 0;
+            int line = 1;
+            for (int i = 0; i < token.Position && i < data.Length; i++) {
+                if (data[i] == '\n') line++;
+            }
+            return line;
+        }
+
+        void Save(CallExpression call, Class type, bool scoped = false) {
             Writer.Write(call.Function.Real);
-            Writer.Write("(NEW(");
-            Writer.Write(type.Real ?? type.Token.Value);
-            Writer.Write(",1,");
-            Writer.Write(type.ID);
-            Writer.Write(", __current_region__)");
+            if (scoped) {
+                Writer.Write("(SCOPE(");
+                Writer.Write(type.Real ?? type.Token.Value);
+                Writer.Write(",");
+                Writer.Write(type.ID);
+                Writer.Write(")");
+            } else {
+                Writer.Write('(');
+                SaveNew(call.Token);
+                Writer.Write(type.Real ?? type.Token.Value);
+                Writer.Write(",1,");
+                Writer.Write(type.ID);
+                Writer.Write(", __current_region__)");
+            }
             foreach (var value in call.Arguments) {
                 Writer.Write(',');
                 Save(value);
@@ -1734,6 +2587,10 @@ namespace Run {
                         }
                         break;
                 }
+                if (exp.From is Var v && captured.TryGetValue(v, out var reference)) {
+                    Writer.Write(reference);
+                    return;
+                }
                 Writer.Write(exp.From.Real ?? exp.From.Token.Value);
                 return;
             }
@@ -1747,11 +2604,13 @@ namespace Run {
                     Writer.Write(" == ");
                     Writer.Write(exp.Right.Type.ID);
                     break;
-                case IdentifierExpression:
+                case Expression when exp.Left.Type == null || (exp.Left.Type.IsPrimitive || exp.Left.Type.IsNative) && exp.Left.Type.IsAny == false && exp.Left.Type != Builder.Pointer:
+                    // values are never boxed, their static type is the dynamic one;
+                    // any and pointer may hold an object, so those are checked below
+                    Writer.Write(IsBasedOn(exp.Left.Type, exp.Right.Type) ? "true" : "false");
+                    break;
+                default:
                     Writer.Write("IS(");
-                    if (exp.Left.Type.IsPrimitive) {
-                        Writer.Write("&");
-                    }
                     Save(exp.Left);
                     Writer.Write(", ");
                     Writer.Write(exp.Right.Type.ID);
@@ -1760,6 +2619,13 @@ namespace Run {
             }
         }
 
+        static bool IsBasedOn(Class type, Class based) {
+            for (; type != null; type = type.Base) {
+                if (type == based) return true;
+            }
+            return false;
+        }
+
         void Save(AsExpression exp) {
             if (exp.Type == null) return;
             if (exp.Type.IsPrimitive == false && exp.Type.IsNative == false) {
@@ -1817,10 +2683,27 @@ namespace Run {
                 SaveNative(exp);
                 return;
             }
-            Writer.Write(exp.Function?.Real ?? exp.Real ?? exp.Token.Value);
+            var target = exp.Caller is Base ? exp.Function : Devirtualize(exp.Function);
+            if (target != null && exp.Caller != null && SaveInlined(exp, target)) {
+                return;
+            }
+            if (IsConcat(exp.Function) && SaveConcat(exp)) {
+                return;
+            }
+            if (target == null) {
+                Writer.Write(exp.Function.Real);
+                Writer.Write("_virtual");
+            } else {
+                Writer.Write(target.Real ?? exp.Real ?? exp.Token.Value);
+            }
             Writer.Write('(');
             if (exp.Caller != null && exp.Function.Access != AccessType.STATIC) {
-                Save(exp.Caller);
+                if (target != null && target != exp.Function) {
+                    Writer.Write('(');
+                    Writer.Write(target.Parent.Real);
+                    Writer.Write("*)");
+                }
+                SaveChecked(exp.Caller);
                 if (exp.Arguments.Count > 0) Writer.Write(", ");
             }
             for (int i = 0; i < exp.Arguments.Count; i++) {
@@ -1833,7 +2716,10 @@ namespace Run {
                     Writer.Write(", ");
                 }
             }
-            Writer.Write(",__current_region__)");
+            if (exp.Arguments.Count > 0 || exp.Caller != null && exp.Function.Access != AccessType.STATIC) {
+                Writer.Write(',');
+            }
+            Writer.Write("__current_region__)");
         }
 
         void Save(Default exp) {
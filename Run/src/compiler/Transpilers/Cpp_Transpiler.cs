@@ -302,6 +302,11 @@ namespace Run {
                 return;
             }
             Writer.Write("class ");
+            if (cls.Align > 0) {
+                Writer.Write("alignas(");
+                Writer.Write(cls.Align);
+                Writer.Write(") ");
+            }
             Writer.Write(cls.Real);
             if (cls.IsBased) {
                 Writer.Write(": public ");
@@ -511,9 +516,13 @@ namespace Run {
 
         void Save(BinaryExpression exp) {
             if (exp == null) return;
+            // bitwise operators bind tighter in Run than in C++
+            var bitwise = exp.Token.Type is TokenType.BITWISE_AND or TokenType.BITWISE_OR or TokenType.XOR;
+            if (bitwise) Writer.Write('(');
             Save(exp.Left);
             Writer.Write(exp.Token.Value);
             Save(exp.Right);
+            if (bitwise) Writer.Write(')');
         }
 
         void Save(UnaryExpression exp) {
@@ -971,9 +980,9 @@ namespace Run {
 
         void Save(Scope exp) {
             if (exp == null) return;
-            Writer.Write("SCOPE(");
-            Writer.Write(exp.Token.Value);
-            Writer.Write(")");
+            Writer.WriteLine("{");
+            SaveBlock(exp);
+            Writer.WriteLine("}");
         }
 
         void Save(TypeOf exp) {
@@ -0,0 +1,150 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Linq;
+using System.Security.Cryptography;
+using System.Text;
+
+namespace Run {
+    public enum BuildProfile {
+        Debug,
+        Release,
+        Pgo,
+    }
+
+    // the C compiler a build profile runs with. Debug takes tcc when there is
+    // one, release and pgo want gcc or clang. Programs on threads or atomics
+    // want them too, tcc has neither _Atomic nor the __atomic builtins.
+    // Objects are cached per profile, keyed by the generated source, the
+    // runtime headers, the flags and the compiler
+    public class Toolchain {
+        public string Compiler { get; private set; }
+        public BuildProfile Profile { get; private set; }
+        public bool IsTcc { get; private set; }
+        public bool IsClang { get; private set; }
+        readonly List<string> Flags = [];
+
+        public static Toolchain Find(BuildProfile profile, bool threads = false) {
+            var toolchain = new Toolchain { Profile = profile };
+            var cc = Environment.GetEnvironmentVariable("CC");
+            if (string.IsNullOrEmpty(cc) == false) {
+                toolchain.Compiler = FindExecutable(cc);
+            }
+            if (toolchain.Compiler == null && profile == BuildProfile.Debug && threads == false) {
+                toolchain.Compiler = Directory.EnumerateFiles(AppContext.BaseDirectory, "tcc.exe", SearchOption.AllDirectories).FirstOrDefault() ?? FindExecutable("tcc");
+            }
+            toolchain.Compiler ??= FindExecutable("gcc") ?? FindExecutable("clang") ?? FindExecutable("cc");
+            if (toolchain.Compiler == null && profile != BuildProfile.Debug && threads == false) {
+                // still better than not building at all
+                toolchain.Compiler = FindExecutable("tcc");
+            }
+            if (toolchain.Compiler == null) return null;
+            var name = Path.GetFileNameWithoutExtension(toolchain.Compiler);
+            toolchain.IsTcc = name.StartsWith("tcc");
+            toolchain.IsClang = name.StartsWith("clang");
+            if (toolchain.IsTcc) {
+                toolchain.Profile = BuildProfile.Debug;
+            }
+            // derived structs embed their base as an unnamed member
+            toolchain.Flags.Add("-fms-extensions");
+            // arena.h keeps the arenas of ended threads through pthread keys,
+            // every program needs the library, not just the parallel ones
+            if (toolchain.IsTcc == false) toolchain.Flags.Add("-pthread");
+            switch (toolchain.Profile) {
+                case BuildProfile.Debug:
+                    if (toolchain.IsTcc == false) toolchain.Flags.AddRange(["-O0", "-g"]);
+                    break;
+                default:
+                    // debug builds show the warnings of the generated C, the others stay quiet
+                    toolchain.Flags.AddRange(["-w", "-O3", "-march=native", "-flto"]);
+                    break;
+            }
+            return toolchain;
+        }
+
+        static string FindExecutable(string name) {
+            if (Path.IsPathRooted(name)) return File.Exists(name) ? name : null;
+            var suffix = OperatingSystem.IsWindows() && Path.HasExtension(name) == false ? ".exe" : "";
+            foreach (var dir in (Environment.GetEnvironmentVariable("PATH") ?? "").Split(Path.PathSeparator)) {
+                if (dir.Length == 0) continue;
+                var path = Path.Combine(dir, name + suffix);
+                if (File.Exists(path)) return path;
+            }
+            return null;
+        }
+
+        // compiles source into output, training the pgo profile with the given arguments
+        public bool Build(string source, string output, IEnumerable<string> directories, List<string> libraries, string training = null) {
+            var includes = directories.Select(d => "-I" + d).ToArray();
+            var key = Key(source, directories, [.. Flags, Profile == BuildProfile.Pgo ? training ?? "" : ""]);
+            var cache = Path.Combine(Path.GetDirectoryName(Path.GetFullPath(source)), ".cache", Profile.ToString().ToLowerInvariant());
+            Directory.CreateDirectory(cache);
+            var obj = Path.Combine(cache, key + ".o");
+            if (File.Exists(obj) == false) {
+                var built = Profile == BuildProfile.Pgo
+                    ? Train(source, obj, includes, libraries, training)
+                    : Run(Compiler, [.. Flags, .. includes, "-c", source, "-o", obj]);
+                if (built == false) {
+                    File.Delete(obj);
+                    return false;
+                }
+            }
+            return Run(Compiler, [.. Flags, obj, "-o", output, .. Libraries(libraries)]);
+        }
+
+        // first build is instrumented and runs once, the second one is
+        // optimized with what it counted. The object path is the same in
+        // both, gcc names the profile data after it
+        bool Train(string source, string obj, string[] includes, List<string> libraries, string training) {
+            var dir = Path.ChangeExtension(obj, ".pgo");
+            Directory.CreateDirectory(dir);
+            var raw = Path.Combine(dir, "default.profraw");
+            var data = Path.Combine(dir, "default.profdata");
+            string[] generate = IsClang ? ["-fprofile-instr-generate=" + raw] : ["-fprofile-generate=" + dir];
+            var instrumented = Path.Combine(dir, "train" + (OperatingSystem.IsWindows() ? ".exe" : ""));
+            if (Run(Compiler, [.. Flags, .. generate, .. includes, "-c", source, "-o", obj]) == false) return false;
+            if (Run(Compiler, [.. Flags, .. generate, obj, "-o", instrumented, .. Libraries(libraries)]) == false) return false;
+            // a failing training run still leaves a usable profile
+            Run(instrumented, (training ?? "").Split(' ', StringSplitOptions.RemoveEmptyEntries));
+            string[] use = ["-fprofile-use=" + dir, "-fprofile-correction", "-Wno-missing-profile"];
+            if (IsClang) {
+                var profdata = FindExecutable("llvm-profdata");
+                use = profdata != null && Run(profdata, ["merge", "-output=" + data, raw]) ? ["-fprofile-instr-use=" + data] : [];
+            }
+            return Run(Compiler, [.. Flags, .. use, .. includes, "-c", source, "-o", obj]);
+        }
+
+        static IEnumerable<string> Libraries(List<string> libraries) {
+            foreach (var library in libraries) {
+                var dir = Path.GetDirectoryName(library);
+                if (string.IsNullOrEmpty(dir) == false) yield return "-L" + dir;
+                yield return "-l" + Path.GetFileName(library);
+            }
+        }
+
+        // the headers of the include directories are part of the object too,
+        // a changed runtime must not link against a stale build
+        string Key(string source, IEnumerable<string> directories, IEnumerable<string> flags) {
+            var text = new StringBuilder(Compiler).Append('\n').AppendJoin(' ', flags).Append('\n').Append(File.ReadAllText(source));
+            foreach (var dir in directories.Where(Directory.Exists)) {
+                foreach (var header in Directory.EnumerateFiles(dir, "*.h").Order(StringComparer.Ordinal)) {
+                    text.Append('\n').Append(Path.GetFileName(header)).Append('\n').Append(File.ReadAllText(header));
+                }
+            }
+            return Convert.ToHexString(SHA256.HashData(Encoding.UTF8.GetBytes(text.ToString())))[..16].ToLowerInvariant();
+        }
+
+        static bool Run(string file, IEnumerable<string> arguments) {
+            var info = new ProcessStartInfo(file) {
+                WindowStyle = ProcessWindowStyle.Hidden,
+            };
+            foreach (var argument in arguments) {
+                info.ArgumentList.Add(argument);
+            }
+            using var proc = Process.Start(info);
+            proc.WaitForExit();
+            return proc.ExitCode == 0;
+        }
+    }
+}
@@ -41,6 +41,7 @@ namespace Run {
             if (includeBuiltin) {
                 RegisterBuiltinTypes();
             }
+            Program.ParseInstances();
             if (Program.HasErrors || Program.Errors.Count > 0) {
                 return;
             }
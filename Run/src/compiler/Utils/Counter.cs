@@ -27,7 +27,6 @@
                 case BinaryExpression pb: Count(pb); break;
                 case IdentifierExpression ie: Count(ie); break;
                 case TernaryExpression te: Count(te); break;
-                case Scope scope: Count(scope); break;
             }
         }
 
@@ -78,8 +77,6 @@
             }
         }
 
-        static void Count(Scope scope) => Count(scope.Type);
-
         static void Count(If i) {
             Count(i.Condition);
             Count(i as Block);
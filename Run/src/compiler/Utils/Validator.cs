@@ -1,4 +1,5 @@
 ﻿using System;
+using System.Collections.Generic;
 using System.Linq;
 using System.Text;
 
@@ -9,6 +10,284 @@ namespace Run {
         public void Validate() {
             Validate(Builder.Program);
             ValidateInterfaces();
+            ValidateEscapes();
+            ValidateNullChecks();
+            ValidateAtomics();
+        }
+
+        readonly Dictionary<Function, bool> keepsThis = new(0);
+
+        // a new assigned to a local that never leaves its function is built
+        // in the function frame instead of the arena
+        void ValidateEscapes() {
+            foreach (var func in Builder.Program.FindChildren<Function>()) {
+                if (func.IsNative) continue;
+                foreach (var v in func.FindChildren<Var>()) {
+                    if (v is Parameter || v.Initializer is not NewExpression ne || ne.IsScoped) continue;
+                    if (ne.Content is not ConstructorExpression ctor || ctor.Function == null) continue;
+                    if (ne.Type == null || ne.Type.IsPrimitive || ne.Type.IsNative || v.TypeArray) continue;
+                    if (KeepsThis(ctor.Function) == false) continue;
+                    if (Escapes(v, func)) continue;
+                    ne.IsScoped = true;
+                }
+            }
+        }
+
+        bool Escapes(Var v, Function func) {
+            foreach (var node in Nodes(func)) {
+                if (node is IdentifierExpression id && id.Token?.Value == v.Token.Value) {
+                    if (id.Parent is DotExpression member && member.Right == id) continue;
+                    if (id.From != v || IsLocalUse(id) == false) return true;
+                }
+            }
+            return false;
+        }
+
+        // uses that can't hand the object to anyone else
+        bool IsLocalUse(Expression exp) {
+            switch (exp.Parent) {
+                case DotExpression dot when dot.Left == exp:
+                    return dot.Right switch {
+                        IdentifierExpression field => field.From is Field,
+                        CallExpression call => call.Function != null && KeepsThis(call.Function),
+                        _ => false,
+                    };
+                case CallExpression call when call.Caller == exp:
+                    return call.Function != null && KeepsThis(call.Function);
+                case AssignExpression assign when assign.Left == exp:
+                case IsExpression @is when @is.Left == exp:
+                    return true;
+                case Block block when block.Parent is Delete:
+                    return true;
+            }
+            return false;
+        }
+
+        // a member keeps 'this' when it only touches fields or calls members that keep it too
+        bool KeepsThis(Function func) {
+            if (keepsThis.TryGetValue(func, out var keeps)) return keeps;
+            keepsThis[func] = false;
+            if (func.IsNative || func.Parent is not Class) return false;
+            foreach (var node in Nodes(func)) {
+                switch (node) {
+                    case ThisExpression t when IsLocalUse(t) == false:
+                        return false;
+                    case IdentifierExpression id when id.Token?.Value == "this" && IsLocalUse(id) == false:
+                        return false;
+                    case IdentifierExpression id when id.From is GetterSetter && id.Parent is not DotExpression:
+                        return false;
+                }
+            }
+            return keepsThis[func] = true;
+        }
+
+        internal static IEnumerable<AST> Nodes(AST ast) {
+            if (ast == null) yield break;
+            yield return ast;
+            foreach (var child in Children(ast)) {
+                foreach (var node in Nodes(child)) {
+                    yield return node;
+                }
+            }
+        }
+
+        static IEnumerable<AST> Children(AST ast) {
+            return ast switch {
+                If i => [i.Condition, .. i.Children],
+                For f => [f.Start, f.Condition, f.Step, .. f.Children],
+                Switch sw => [sw.Expression, .. sw.Children],
+                Case c => [.. c.Expressions, .. c.Children],
+                Defer d => [d.Expression, .. d.Children],
+                Block b => b.Children,
+                Var v => [v.Initializer],
+                Delete d => [d.Block],
+                PropertySetter p => [p.This, p.Caller, .. p.Arguments],
+                CallExpression call => [call.Caller, .. call.Arguments],
+                BinaryExpression bin => [bin.Left, bin.Right],
+                ContentExpression content => [content.Content],
+                TernaryExpression t => [t.Condition, t.True, t.False],
+                ObjectExpression obj => obj.Assignments,
+                _ => [],
+            };
+        }
+
+        // an @atomic field or global holds a single value, a number, a bool or
+        // a reference, so the C compiler can update it without a lock
+        void ValidateAtomics() {
+            foreach (var v in Builder.Program.FindChildren<Var>()) {
+                if (v.IsAtomic == false) continue;
+                if (v.IsConst || v.TypeArray || v.Arguments?.Count > 0 || v.Type is Class { IsPrimitive: true, IsNumber: false } && v.Type.Token.Value != "bool") {
+                    Builder.Program.AddError(v.Token, Error.InvalidAtomic);
+                }
+            }
+        }
+
+        // in safe mode every dereference is checked against null, except the
+        // ones on values proven set: this, new and locals holding either,
+        // locals tested with != null and locals already checked before on
+        // the same path
+        void ValidateNullChecks() {
+            if (Builder.Program.SafeMode == false) return;
+            foreach (var func in Builder.Program.FindChildren<Function>()) {
+                if (func.IsNative) continue;
+                var proven = new HashSet<Var>();
+                foreach (var child in func.Children) {
+                    Prove(child, proven);
+                }
+            }
+        }
+
+        void Prove(AST ast, HashSet<Var> proven) {
+            switch (ast) {
+                case null:
+                case Function:
+                    return;
+                case If i: {
+                        Prove(i.Condition, proven);
+                        var inner = new HashSet<Var>(proven);
+                        Tested(i.Condition, inner);
+                        foreach (var child in i.Children) Prove(child, inner);
+                        Forget(i, proven);
+                        return;
+                    }
+                case For f: {
+                        Prove(f.Start, proven);
+                        // a later iteration sees what the body assigned
+                        Forget(f, proven);
+                        var inner = new HashSet<Var>(proven);
+                        Prove(f.Condition, inner);
+                        Tested(f.Condition, inner);
+                        foreach (var child in f.Children) Prove(child, inner);
+                        Prove(f.Step, inner);
+                        return;
+                    }
+                case Defer d:
+                    foreach (var child in d.Children) Prove(child, []);
+                    return;
+                // a goto can come from anywhere, after what it skipped
+                case Label:
+                    proven.Clear();
+                    return;
+                case Block b: {
+                        var inner = new HashSet<Var>(proven);
+                        foreach (var child in Children(b)) Prove(child, inner);
+                        Forget(b, proven);
+                        return;
+                    }
+                case Var var:
+                    Prove(var.Initializer, proven);
+                    Assign(var, var.Initializer, proven);
+                    return;
+                case AssignExpression assign when assign.Left is IdentifierExpression { From: Var local }:
+                    Prove(assign.Right, proven);
+                    Assign(local, assign.Right, proven);
+                    return;
+                case BinaryExpression bin when bin.Token.Type is TokenType.AND or TokenType.OR: {
+                        Prove(bin.Left, proven);
+                        var inner = new HashSet<Var>(proven);
+                        if (bin.Token.Type == TokenType.AND) Tested(bin.Left, inner);
+                        Prove(bin.Right, inner);
+                        return;
+                    }
+                case TernaryExpression t: {
+                        Prove(t.Condition, proven);
+                        var inner = new HashSet<Var>(proven);
+                        Tested(t.Condition, inner);
+                        Prove(t.True, inner);
+                        Prove(t.False, new HashSet<Var>(proven));
+                        return;
+                    }
+                case Ref r:
+                    if (r.Content is IdentifierExpression { From: Var target }) proven.Remove(target);
+                    return;
+                // DELETE sets what it frees to null
+                case Delete delete:
+                    Deleted(delete, proven);
+                    return;
+                case DotExpression dot:
+                    Prove(dot.Left, proven);
+                    Checked(dot.Left, proven);
+                    Prove(dot.Right, proven);
+                    return;
+                case CallExpression call:
+                    Prove(call.Caller, proven);
+                    if (call.Caller is Expression caller) Checked(caller, proven);
+                    foreach (var arg in call.Arguments) Prove(arg, proven);
+                    return;
+            }
+            foreach (var child in Children(ast)) {
+                Prove(child, proven);
+            }
+        }
+
+        // only locals are tracked, fields and globals change behind calls
+        static bool IsLocal(Var v) => v is not Field && v.TypeArray == false && v.FindParent<Function>() != null;
+
+        static bool IsProven(Expression exp, HashSet<Var> proven) => exp switch {
+            ThisExpression or NewExpression => true,
+            IdentifierExpression { Token.Value: "this" } => true,
+            IdentifierExpression { From: Var v } => proven.Contains(v),
+            ParentesesExpression p => IsProven(p.Content as Expression, proven),
+            _ => false,
+        };
+
+        static void Assign(Var v, Expression value, HashSet<Var> proven) {
+            if (IsLocal(v) && IsProven(value, proven)) {
+                proven.Add(v);
+            } else {
+                proven.Remove(v);
+            }
+        }
+
+        // after a check the value is set for the rest of the path, a null one stopped the program
+        static void Checked(Expression exp, HashSet<Var> proven) {
+            exp.NotNull = IsProven(exp, proven);
+            if (exp is IdentifierExpression { From: Var v } && IsLocal(v)) proven.Add(v);
+        }
+
+        static void Tested(Expression condition, HashSet<Var> proven) {
+            switch (condition) {
+                case BinaryExpression { Token.Type: TokenType.AND } and:
+                    Tested(and.Left, proven);
+                    Tested(and.Right, proven);
+                    break;
+                case ParentesesExpression p:
+                    Tested(p.Content as Expression, proven);
+                    break;
+                case BinaryExpression { Token.Type: TokenType.DIFFERENT or TokenType.NOT_EQUAL } bin:
+                    var tested = bin.Right is LiteralExpression { Token.Type: TokenType.NULL } ? bin.Left : bin.Left is LiteralExpression { Token.Type: TokenType.NULL } ? bin.Right : null;
+                    if (tested is IdentifierExpression { From: Var v } && IsLocal(v)) {
+                        proven.Add(v);
+                    }
+                    break;
+            }
+        }
+
+        // whatever a block assigns can't be trusted after it or on its next
+        // run, nothing can once a goto may have jumped into it
+        static void Forget(Block block, HashSet<Var> proven) {
+            foreach (var node in Nodes(block)) {
+                switch (node) {
+                    case Label:
+                        proven.Clear();
+                        return;
+                    case AssignExpression { Left: IdentifierExpression { From: Var v } }:
+                        proven.Remove(v);
+                        break;
+                    case Ref { Content: IdentifierExpression { From: Var v } }:
+                        proven.Remove(v);
+                        break;
+                    case Delete delete:
+                        Deleted(delete, proven);
+                        break;
+                }
+            }
+        }
+
+        static void Deleted(Delete delete, HashSet<Var> proven) {
+            foreach (var child in delete.Block.Children) {
+                if (child is IdentifierExpression { From: Var v }) proven.Remove(v);
+            }
         }
         void ValidateInterfaces() {
             foreach (var cls in Builder.Classes.Values) {
@@ -50,7 +329,8 @@ namespace Run {
                 return;
             }
             if (ast.Validated) return;
-            if (ast is not Property && ast is not Indexer && ast is ValueType vt && vt.Type != null && vt.Type.IsTemporary == false) return;
+            // a declared type does not validate the initializer, var n:i32 = size still has to find size
+            if (ast is not Property && ast is not Indexer && ast is ValueType vt && vt.Type != null && vt.Type.IsTemporary == false && (vt is not Var declared || declared.Initializer == null)) return;
             switch (ast) {
                 case Operator op: Validate(op); break;
                 case Function f: Validate(f); break;
@@ -72,7 +352,6 @@ namespace Run {
                 case Return ret: Validate(ret); break;
                 case TypeOf tp: Validate(tp); break;
                 case Ref r: Validate(r); break;
-                case Scope sc: Validate(sc); break;
                 case SizeOf sz: Validate(sz); break;
                 case Iterator it: Validate(it); break;
                 case ThisExpression t: Validate(t); break;
@@ -120,7 +399,7 @@ namespace Run {
                     return;
                 }
             }
-            if (AreCompatible(bin.Left, bin.Right) == false) {
+            if (IsAssignable(bin.Right, bin.Left) == false) {
                 Builder.Program.AddError(bin.Right.Token ?? bin.Left.Token ?? bin.Token, Error.IncompatibleType);
                 return;
             }
@@ -136,9 +415,6 @@ namespace Run {
 
         void Validate(IsExpression @is) {
             Validate(@is.Left);
-            if (@is.Left is IdentifierExpression id && id.From is Var v) {
-                v.NeedRegister = true;
-            }
             Validate(@is.Right);
             //@is.Type = @is.Right.Type;
             @is.Type = Builder.Bool;
@@ -344,7 +620,7 @@ namespace Run {
                     @enum.IsPrimitive = true;
                 }
                 if (found == null) continue;
-                if (found.IsNumber == false && found != Builder.String) {
+                if (found.IsNumber == false && found != Builder.String && found != Builder.CharSequence) {
                     Builder.Program.AddError(@enum.Token, Error.IncompatibleType);
                     continue;
                 }
@@ -376,6 +652,40 @@ namespace Run {
             if (f.Condition != null && f.HasRange == false) Validate(f.Condition);
             if (f.Step != null) Validate(f.Step);
             Validate(f as Block);
+            if (f.IsParallel) ValidateParallel(f);
+        }
+
+        // the body becomes a task on the pool: it runs over a range and
+        // can't jump out of it or defer past it
+        void ValidateParallel(For f) {
+            var ranged = f.Stage switch {
+                0 => f.HasRange && f.Start == null,
+                1 => f.Start is Var v && (f.HasRange && v.Initializer == null || v.Initializer is RangeExpression),
+                _ => false,
+            };
+            if (ranged == false) {
+                Builder.Program.AddError(f.Token, Error.ExpectingParallelRange);
+                return;
+            }
+            // the pool splits an int range
+            var range = (f.Start as Var)?.Initializer as RangeExpression;
+            foreach (var bound in new[] { range?.Left, range?.Right ?? f.Condition }) {
+                if (bound?.Type != null && bound.Type != Builder.I32) {
+                    Builder.Program.AddError(bound.Token, Error.ExpectingParallelI32);
+                    return;
+                }
+            }
+            foreach (var node in Nodes(f)) {
+                switch (node) {
+                    case Return:
+                    case Goto:
+                    case Label:
+                    case Defer:
+                    case Break when node.FindParent<For>() == f:
+                        Builder.Program.AddError(node.Token, Error.NotAllowedInParallelFor);
+                        return;
+                }
+            }
         }
         void Validate(Else e) {
             if (e.Validated) return;
@@ -454,6 +764,10 @@ namespace Run {
                     }
                     return;
                 }
+                // a literal given to a declared type it converts to
+                if (var.Initializer is LiteralExpression lit && Builder.Program.Implicits.TryGetValue(lit.Type.Token.Value, out var ast) && ast is Constructor ctor && ctor.Type?.Token.Value == var.Type.Token?.Value) {
+                    ValidateImplicit(var);
+                }
             }
             var func = var.FindParent<Function>();
             if (var.FindParent<Class>() is Class c) {
@@ -492,6 +806,7 @@ namespace Run {
                 case Constructor ctor:
                     var ne = new NewExpression(var, false) {
                         QualifiedName = ctor.Real,
+                        IsImplicit = true,
                         Type = ctor.Type,
                         Token = var.Initializer.Token,
                     };
@@ -657,7 +972,8 @@ namespace Run {
 
         void Validate(BinaryExpression bin) {
             if (ValidateBinaryMembers(bin) == false) return;
-            if (bin.Left.Type != null && bin.Left.Type.HasOperators) {
+            // comparing against null checks the reference, not the operator
+            if (bin.Left.Type != null && bin.Left.Type.HasOperators && bin.Right is not LiteralExpression { Token.Type: TokenType.NULL }) {
                 if (Replacer.Operator(bin, Builder)) return;
             }
 
@@ -683,6 +999,7 @@ namespace Run {
                 Validate(ctor);
                 var exp = new NewExpression(from) {
                     QualifiedName = ctor.Real,
+                    IsImplicit = true,
                     Type = ctor.Type,
                     Token = ctor.Token,
                     Validated = true,
@@ -746,7 +1063,7 @@ namespace Run {
                                 for (int a = 0; a < call.Arguments.Count; a++) {
                                     var arg = call.Arguments[a];
                                     var param = func.Parameters.Children[a] as Parameter;
-                                    if (AreCompatible(arg, param) == false) {
+                                    if (IsAssignable(arg, param) == false) {
                                         goto next;
                                     }
                                 }
@@ -763,6 +1080,22 @@ namespace Run {
             return null;
         }
 
+        // the exact name missed, so some argument is a subtype of its parameter
+        Function FindInModule(CallExpression call) {
+            foreach (var func in Builder.Functions.Values) {
+                if (func.Parent is Class || func.Token.Value != call.Token.Value) continue;
+                if ((func.Parameters?.Children.Count ?? 0) != call.Arguments.Count || func.HasVariadic) continue;
+                for (int a = 0; a < call.Arguments.Count; a++) {
+                    if (IsAssignable(call.Arguments[a], func.Parameters.Children[a] as Parameter) == false) {
+                        goto next;
+                    }
+                }
+                return func;
+            next:;
+            }
+            return null;
+        }
+
         void ValidateMemberCall(CallExpression call) {
             Validate(call.Caller);
             if (call.Caller.Type == null) {
@@ -778,7 +1111,7 @@ namespace Run {
                             //maybe a replace happened and now get it again
                             arg = call.Arguments[a];
                             var param = func.Parameters.Children[a] as Parameter;
-                            if (AreCompatible(arg, param) == false) {
+                            if (IsAssignable(arg, param) == false) {
                                 goto next;
                             }
                         }
@@ -827,6 +1160,10 @@ namespace Run {
                         goto found;
                     }
                 }
+                if (FindInModule(call) is Function m) {
+                    func = m;
+                    goto found;
+                }
                 Builder.Program.AddError(call.Token, Error.UnknownFunctionNameOrWrongParamaters);
                 return;
             }
@@ -836,27 +1173,6 @@ namespace Run {
             call.Real = func.Real;
             Validate(call.Type);
         }
-        void Validate(Scope scope) {
-            if (scope.Validated) return;
-            scope.Validated = true;
-            if (Builder.Classes.TryGetValue(scope.Token.Value, out Class cls) == false) {
-                Builder.Program.AddError(scope.Token, Error.UnknownType);
-                return;
-            }
-            var ctors = cls.FindChildren<Constructor>().ToList();
-            if (ctors.Count > 0) {
-                foreach (var ctor in ctors) {
-                    if (ctor.Parameters == null || ctor.Parameters.Children.Count == 0) {
-                        goto end;
-                    }
-                }
-                Builder.Program.AddError(scope.Token, Error.ScopeOnlyOfConstructorNoParameters);
-                return;
-            }
-        end:
-            scope.Type = cls;
-            Validate(cls);
-        }
         void Validate(SizeOf sizeOf) {
             if (sizeOf.Validated) return;
             sizeOf.Validated = true;
@@ -1098,6 +1414,15 @@ namespace Run {
 
             return false;
         }
+
+        // a value goes where its own type, a base or an interface of it is expected
+        public static bool IsAssignable(ValueType value, ValueType target) {
+            if (AreCompatible(value, target)) return true;
+            var type = value?.Type;
+            if (type == null || target?.Type == null || type.IsPrimitive) return false;
+            return type.IsCompatible(target.Type);
+        }
+
         public static bool AreCompatible(Class t1, Class t2) {
             if (t1 is null && t2 != null && t2.IsPrimitive == false) return true;
             if (t2 is null && t1 != null && t1.IsPrimitive == false) return true;